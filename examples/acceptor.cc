@@ -30,6 +30,29 @@
 namespace rdmapp
 {
 
+   task<std::shared_ptr<queue_pair>> accept_qp(socket::tcp_connection& connection, std::shared_ptr<protected_domain> pd,
+                                               std::shared_ptr<completion_queue> recv_cq,
+                                               std::shared_ptr<completion_queue> send_cq,
+                                               std::shared_ptr<shared_receive_queue> srq)
+   {
+      auto remote_qp = co_await recv_qp(connection);
+      auto local_qp = std::make_shared<queue_pair>(remote_qp.header, pd, recv_cq, send_cq, srq);
+      local_qp->user_data() = std::move(remote_qp.user_data);
+      co_await send_qp(*local_qp, connection);
+      co_return local_qp;
+   }
+
+   task<std::shared_ptr<queue_pair>> accept_qp(socket::tcp_connection& connection, std::shared_ptr<qp_pool> pool)
+   {
+      auto remote_qp = co_await recv_qp(connection);
+      auto local_qp = pool->acquire();
+      local_qp->rtr(remote_qp.header);
+      local_qp->rts();
+      local_qp->user_data() = std::move(remote_qp.user_data);
+      co_await send_qp(*local_qp, connection);
+      co_return local_qp;
+   }
+
    acceptor::acceptor(std::shared_ptr<socket::event_loop> loop, uint16_t port, std::shared_ptr<protected_domain> pd,
                       std::shared_ptr<completion_queue> cq, std::shared_ptr<shared_receive_queue> srq)
       : acceptor(loop, port, pd, cq, cq, srq)
@@ -55,16 +78,46 @@ namespace rdmapp
         srq_(srq)
    {}
 
+   acceptor::acceptor(std::shared_ptr<socket::event_loop> loop, const std::string& hostname, uint16_t port,
+                      std::shared_ptr<qp_pool> pool)
+      : listener_(std::make_unique<socket::tcp_listener>(loop, hostname, port)), pool_(pool)
+   {}
+
+   std::shared_ptr<queue_pair> acceptor::make_qp(const deserialized_qp::qp_header& remote)
+   {
+      if (pool_ == nullptr) {
+         return std::make_shared<queue_pair>(remote, pd_, recv_cq_, send_cq_, srq_);
+      }
+      auto qp = pool_->acquire();
+      qp->rtr(remote);
+      qp->rts();
+      return qp;
+   }
+
    task<std::shared_ptr<queue_pair>> acceptor::accept()
    {
       auto channel = co_await listener_->accept();
       auto connection = socket::tcp_connection(channel);
-      auto remote_qp = co_await recv_qp(connection);
-      auto local_qp = std::make_shared<queue_pair>(remote_qp.header.lid, remote_qp.header.qp_num, remote_qp.header.sq_psn, pd_,
-                                           send_cq_, recv_cq_);
-      local_qp->user_data() = std::move(remote_qp.user_data);
-      co_await send_qp(*local_qp, connection);
-      co_return local_qp;
+      if (pool_ != nullptr) {
+         co_return co_await accept_qp(connection, pool_);
+      }
+      co_return co_await accept_qp(connection, pd_, recv_cq_, send_cq_, srq_);
+   }
+
+   task<std::vector<std::shared_ptr<queue_pair>>> acceptor::accept_bundle()
+   {
+      auto channel = co_await listener_->accept();
+      auto connection = socket::tcp_connection(channel);
+      auto remote_qps = co_await recv_qps(connection);
+      std::vector<std::shared_ptr<queue_pair>> local_qps;
+      local_qps.reserve(remote_qps.size());
+      for (auto& remote_qp : remote_qps) {
+         auto local_qp = make_qp(remote_qp.header);
+         local_qp->user_data() = std::move(remote_qp.user_data);
+         local_qps.push_back(std::move(local_qp));
+      }
+      co_await send_qps(local_qps, connection);
+      co_return local_qps;
    }
 
    acceptor::~acceptor() {}
@@ -0,0 +1,58 @@
+#include <rdmapp/connection_manager.h>
+#include <rdmapp/rdmapp.h>
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Connects a Queue Pair to itself through the connection manager, such as over a soft-RoCE (rxe) device:
+//
+//    rdma link add rxe0 type rxe netdev eth0
+//    ./cm_loopback rxe0 <address of eth0> 2333
+
+static std::vector<uint8_t> to_bytes(const std::string& s) { return std::vector<uint8_t>(s.begin(), s.end()); }
+
+static std::string to_string(const std::vector<uint8_t>& bytes) { return std::string(bytes.begin(), bytes.end()); }
+
+rdmapp::task<void> server(rdmapp::connection_manager& cm)
+{
+   auto qp = co_await cm.accept(to_bytes("accepted"));
+   std::cout << "Accepted with private data: " << to_string(qp->user_data()) << std::endl;
+   char buffer[6];
+   co_await qp->recv(buffer, sizeof(buffer));
+   std::cout << "Received from client: " << buffer << std::endl;
+   co_return;
+}
+
+rdmapp::task<void> client(rdmapp::connection_manager& cm, const std::string& address, uint16_t port)
+{
+   auto qp = co_await cm.connect(address, port, to_bytes("connecting"));
+   std::cout << "Connected with private data: " << to_string(qp->user_data()) << std::endl;
+   char buffer[6] = "hello";
+   co_await qp->send(buffer, sizeof(buffer));
+   std::cout << "Sent to server: " << buffer << std::endl;
+   co_return;
+}
+
+int main(int argc, char* argv[])
+{
+   if (argc != 4) {
+      std::cout << "Usage: " << argv[0] << " [device] [address] [port]" << std::endl;
+      return 1;
+   }
+   auto device = std::make_shared<rdmapp::device>(argv[1], 1);
+   auto pd = std::make_shared<rdmapp::protected_domain>(device);
+   auto cq = std::make_shared<rdmapp::completion_queue>(device);
+   auto cq_poller = std::make_shared<rdmapp::cq_poller>(cq);
+   std::string address = argv[2];
+   auto port = static_cast<uint16_t>(std::stoi(argv[3]));
+
+   rdmapp::connection_manager cm(pd, cq);
+   cm.listen(address, port);
+   auto accepted = server(cm);
+   client(cm, address, port).get_future().get();
+   accepted.get_future().get();
+   return 0;
+}
@@ -0,0 +1,197 @@
+#include "connection_cache.h"
+
+#include <rdmapp/error.h>
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "rdmapp/detail/waiter_queue.h"
+
+namespace rdmapp
+{
+   size_t endpoint_hash::operator()(const endpoint& ep) const
+   {
+      size_t seed = std::hash<std::string>()(ep.hostname);
+      seed ^= std::hash<uint32_t>()((uint32_t(ep.port) << 16) ^ ep.tag) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+      return seed;
+   }
+
+   // A handshake in flight, awaited by the callers that asked for the same endpoint meanwhile.
+   class pending_connection : public noncopyable
+   {
+      std::mutex mutex_;
+      bool done_{};
+      std::shared_ptr<queue_pair> qp_;
+      std::exception_ptr exception_;
+      detail::waiter_queue waiters_;
+
+      struct awaiter : public detail::async_waiter
+      {
+         pending_connection& pending_;
+
+         bool await_ready() const noexcept { return false; }
+
+         bool await_suspend(std::coroutine_handle<> h)
+         {
+            std::lock_guard lock(pending_.mutex_);
+            if (pending_.done_) {
+               return false;
+            }
+            h_ = h;
+            pending_.waiters_.push_back(*this);
+            return true;
+         }
+
+         std::shared_ptr<queue_pair> await_resume()
+         {
+            if (pending_.exception_) {
+               std::rethrow_exception(pending_.exception_);
+            }
+            return pending_.qp_;
+         }
+      };
+
+     public:
+      [[nodiscard]] auto wait() { return awaiter{{}, *this}; }
+
+      // Resume the waiters on the calling thread, the one that ran the handshake.
+      void complete(std::shared_ptr<queue_pair> qp, std::exception_ptr exception)
+      {
+         detail::async_waiter* waiters;
+         {
+            std::lock_guard lock(mutex_);
+            qp_ = std::move(qp);
+            exception_ = std::move(exception);
+            done_ = true;
+            waiters = waiters_.take_all();
+         }
+         while (waiters != nullptr) {
+            auto next = waiters->next_;
+            detail::resume_waiter(nullptr, waiters->h_);
+            waiters = next;
+         }
+      }
+   };
+
+   connection_cache::connection_cache(std::shared_ptr<socket::event_loop> loop, std::shared_ptr<protected_domain> pd,
+                                      std::shared_ptr<completion_queue> recv_cq,
+                                      std::shared_ptr<completion_queue> send_cq,
+                                      std::shared_ptr<shared_receive_queue> srq, size_t max_connections)
+      : loop_(loop), pd_(pd), recv_cq_(recv_cq), send_cq_(send_cq), srq_(srq), max_connections_(max_connections)
+   {}
+
+   connection_cache::connection_cache(std::shared_ptr<socket::event_loop> loop, std::shared_ptr<qp_pool> pool,
+                                      size_t max_connections)
+      : loop_(loop), pool_(pool), max_connections_(max_connections)
+   {}
+
+   connector connection_cache::make_connector(const endpoint& ep) const
+   {
+      if (pool_ != nullptr) {
+         return connector(loop_, ep.hostname, ep.port, pool_);
+      }
+      return connector(loop_, ep.hostname, ep.port, pd_, recv_cq_, send_cq_, srq_);
+   }
+
+   bool connection_cache::make_room()
+   {
+      if (entries_.size() < max_connections_) {
+         return true;
+      }
+      for (auto it = lru_.rbegin(); it != lru_.rend(); ++it) {
+         auto entry = entries_.find(*it);
+         // Only the cache holds it, so nobody is using it.
+         if (entry->second.qp.use_count() == 1) {
+            entries_.erase(entry);
+            lru_.erase(std::next(it).base());
+            return true;
+         }
+      }
+      return false;
+   }
+
+   task<std::shared_ptr<queue_pair>> connection_cache::get(std::string hostname, uint16_t port, uint32_t tag)
+   {
+      endpoint ep{std::move(hostname), port, tag};
+      std::shared_ptr<queue_pair> qp;
+      std::shared_ptr<pending_connection> pending;
+      bool leader = false;
+      {
+         std::lock_guard lock(mutex_);
+         auto it = entries_.find(ep);
+         if (it != entries_.end() && it->second.qp != nullptr) {
+            lru_.splice(lru_.begin(), lru_, it->second.lru);
+            qp = it->second.qp;
+         }
+         else if (it != entries_.end()) {
+            pending = it->second.pending;
+         }
+         else {
+            if (!make_room()) {
+               throw_with("connection cache is full: %zu qps in use", entries_.size());
+            }
+            pending = std::make_shared<pending_connection>();
+            entries_.emplace(ep, entry{nullptr, pending, lru_.end()});
+            leader = true;
+         }
+      }
+      if (qp != nullptr) {
+         co_return qp;
+      }
+      if (!leader) {
+         co_return co_await pending->wait();
+      }
+
+      std::exception_ptr exception;
+      try {
+         auto c = make_connector(ep);
+         qp = co_await c.connect();
+      }
+      catch (...) {
+         exception = std::current_exception();
+      }
+      {
+         std::lock_guard lock(mutex_);
+         // evict() may have dropped the entry meanwhile. The Queue Pair is then only handed to the waiters.
+         auto it = entries_.find(ep);
+         if (it != entries_.end() && it->second.pending == pending) {
+            it->second.pending = nullptr;
+            if (exception) {
+               entries_.erase(it);
+            }
+            else {
+               it->second.qp = qp;
+               it->second.lru = lru_.insert(lru_.begin(), ep);
+            }
+         }
+      }
+      pending->complete(qp, exception);
+      if (exception) {
+         std::rethrow_exception(exception);
+      }
+      co_return qp;
+   }
+
+   void connection_cache::evict(const std::string& hostname, uint16_t port, uint32_t tag)
+   {
+      std::lock_guard lock(mutex_);
+      auto it = entries_.find(endpoint{hostname, port, tag});
+      if (it == entries_.end()) {
+         return;
+      }
+      if (it->second.qp != nullptr) {
+         lru_.erase(it->second.lru);
+      }
+      entries_.erase(it);
+   }
+
+   size_t connection_cache::size()
+   {
+      std::lock_guard lock(mutex_);
+      return entries_.size();
+   }
+} // namespace rdmapp
@@ -1,7 +1,12 @@
 #include "connector.h"
 
+#include <rdmapp/error.h>
 #include <rdmapp/protected_domain.h>
 
+#include <cstddef>
+#include <memory>
+#include <vector>
+
 #include "qp_transmission.h"
 #include "socket/tcp_connection.h"
 
@@ -9,25 +14,19 @@ namespace rdmapp
 {
 
    /**
-    * @brief This function is used to receive a Queue Pair from a remote peer.
+    * @brief This function is used to connect a Queue Pair to a remote peer.
     *
     * @param connection The TCP connection to the remote peer.
-    * @param pd The protection domain of the new Queue Pair.
-    * @param recv_cq The completion queue of recv work completions.
-    * @param send_cq The completion queue of send work completions.
-    * @param srq (Optional) If set, all recv work requests will be posted to this
-    * SRQ.
+    * @param qp_ptr The local Queue Pair, in the INIT state.
     * @return task<std::shared_ptr<qp>> A coroutine that returns a shared pointer
-    * to the new Queue Pair.
+    * to the Queue Pair, in the RTS state.
     */
-   static task<std::shared_ptr<queue_pair>> from_tcp_connection(socket::tcp_connection& connection, std::shared_ptr<protected_domain> pd,
-                                                        std::shared_ptr<completion_queue> recv_cq, std::shared_ptr<completion_queue> send_cq,
-                                                        std::shared_ptr<shared_receive_queue> srq = nullptr)
+   static task<std::shared_ptr<queue_pair>> from_tcp_connection(socket::tcp_connection& connection,
+                                                                std::shared_ptr<queue_pair> qp_ptr)
    {
-      auto qp_ptr = std::make_shared<queue_pair>(pd, recv_cq, send_cq, srq);
       co_await send_qp(*qp_ptr, connection);
       auto remote_qp = co_await recv_qp(connection);
-      qp_ptr->rtr(remote_qp.header.lid, remote_qp.header.qp_num, remote_qp.header.sq_psn);
+      qp_ptr->rtr(remote_qp.header);
       qp_ptr->user_data() = std::move(remote_qp.user_data);
       qp_ptr->rts();
       co_return qp_ptr;
@@ -44,11 +43,46 @@ namespace rdmapp
       : connector(loop, hostname, port, pd, cq, cq, srq)
    {}
 
+   connector::connector(std::shared_ptr<socket::event_loop> loop, const std::string& hostname, uint16_t port,
+                        std::shared_ptr<qp_pool> pool)
+      : loop_(loop), hostname_(hostname), port_(port), pool_(pool)
+   {}
+
+   std::shared_ptr<queue_pair> connector::make_qp()
+   {
+      if (pool_ != nullptr) {
+         return pool_->acquire();
+      }
+      return std::make_shared<queue_pair>(pd_, recv_cq_, send_cq_, srq_);
+   }
+
    task<std::shared_ptr<queue_pair>> connector::connect()
    {
       auto connection = co_await rdmapp::socket::tcp_connection::connect(loop_, hostname_, port_);
-      auto qp = co_await from_tcp_connection(*connection, pd_, recv_cq_, send_cq_, srq_);
+      auto qp = co_await from_tcp_connection(*connection, make_qp());
       co_return qp;
    }
 
+   task<std::vector<std::shared_ptr<queue_pair>>> connector::connect_bundle(size_t count)
+   {
+      auto connection = co_await rdmapp::socket::tcp_connection::connect(loop_, hostname_, port_);
+      std::vector<std::shared_ptr<queue_pair>> qps;
+      qps.reserve(count);
+      for (size_t i = 0; i < count; ++i) {
+         qps.push_back(make_qp());
+      }
+      co_await send_qps(qps, *connection);
+      auto remote_qps = co_await recv_qps(*connection);
+      if (remote_qps.size() != qps.size()) {
+         throw_with("remote answered %zu qps instead of %zu", remote_qps.size(), qps.size());
+      }
+      for (size_t i = 0; i < count; ++i) {
+         auto& remote_qp = remote_qps[i];
+         qps[i]->rtr(remote_qp.header);
+         qps[i]->user_data() = std::move(remote_qp.user_data);
+         qps[i]->rts();
+      }
+      co_return qps;
+   }
+
 } // namespace rdmapp
\ No newline at end of file
@@ -0,0 +1,114 @@
+#include "cq_reactor.h"
+
+#include <rdmapp/detail/debug.h>
+#include <rdmapp/error.h>
+#include <rdmapp/executor.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+namespace rdmapp
+{
+   cq_reactor::cq_reactor(std::shared_ptr<socket::event_loop> loop, std::shared_ptr<completion_queue> cq,
+                          size_t batch_size, std::chrono::milliseconds timer_resolution)
+      : cq_(cq), wc_vec_(batch_size), ts_vec_(batch_size), timers_(std::make_shared<timer_wheel>(timer_resolution))
+   {
+      check_ptr(cq_, "cq pointer null");
+      if (!cq_->channel) {
+         throw std::runtime_error("cq has no completion channel, create it with events enabled");
+      }
+      if (timer_resolution.count() <= 0) {
+         throw std::runtime_error("timer resolution must be positive");
+      }
+      int timer_fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+      check_errno(timer_fd, "failed to create timerfd");
+      timer_channel_ = std::make_shared<socket::channel>(timer_fd, loop);
+      // The channel closes its fd on destruction, while the completion channel must be destroyed through verbs, so
+      // register a duplicate. Both refer to the same open file, which is already non-blocking.
+      int fd = ::dup(cq_->event_fd());
+      check_errno(fd, "failed to dup completion channel fd");
+      channel_ = std::make_shared<socket::channel>(fd, loop);
+      channel_->set_readable_callback([this]() { on_event(); });
+      cq_->request_notify();
+      drain();
+      if (!channel_->wait_readable()) {
+         on_event();
+      }
+      timers_->on_schedule([this](timer_wheel::clock::time_point deadline) { arm_timer(deadline); });
+      timer_channel_->set_readable_callback([this]() { on_timer(); });
+      if (!timer_channel_->wait_readable()) {
+         on_timer();
+      }
+   }
+
+   void cq_reactor::drain()
+   {
+      while (true) {
+         auto nr_wc = cq_->poll(wc_vec_.data(), ts_vec_.data(), wc_vec_.size());
+         for (int i = 0; i < nr_wc; ++i) {
+            auto& wc = wc_vec_[i];
+            RDMAPP_LOG_TRACE("reactor polled cqe wr_id=%p status=%d", reinterpret_cast<void*>(wc.wr_id), wc.status);
+            if (cq_->timestamps) {
+               completion_record::from_wr_id(wc.wr_id)->timestamp_ = ts_vec_[i];
+            }
+            executor::dispatch(wc);
+         }
+         if (static_cast<size_t>(nr_wc) < wc_vec_.size()) {
+            return;
+         }
+      }
+   }
+
+   void cq_reactor::on_event()
+   {
+      // A loop rather than recursion, as the channel may be readable again every time under load.
+      do {
+         while (cq_->consume_event()) {
+         }
+         cq_->request_notify();
+         drain();
+      } while (!channel_->wait_readable());
+   }
+
+   void cq_reactor::arm_timer(timer_wheel::clock::time_point deadline)
+   {
+      std::lock_guard lock(timer_mutex_);
+      if (armed_.has_value() && *armed_ <= deadline) {
+         return;
+      }
+      armed_ = deadline;
+      // steady_clock is CLOCK_MONOTONIC, which the timerfd runs on. A zero it_value would disarm it instead.
+      auto ns = std::max<int64_t>(
+         std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count(), 1);
+      struct itimerspec spec = {};
+      spec.it_value.tv_sec = ns / 1000000000;
+      spec.it_value.tv_nsec = ns % 1000000000;
+      if (::timerfd_settime(timer_channel_->fd(), TFD_TIMER_ABSTIME, &spec, nullptr) != 0) [[unlikely]] {
+         RDMAPP_LOG_ERROR("failed to arm timerfd: %s", strerror(errno));
+      }
+   }
+
+   void cq_reactor::on_timer()
+   {
+      uint64_t expirations;
+      do {
+         while (::read(timer_channel_->fd(), &expirations, sizeof(expirations)) > 0) {
+         }
+         {
+            std::lock_guard lock(timer_mutex_);
+            armed_.reset();
+         }
+         timers_->advance();
+         if (auto next = timers_->next_deadline()) {
+            arm_timer(*next);
+         }
+      } while (!timer_channel_->wait_readable());
+   }
+} // namespace rdmapp
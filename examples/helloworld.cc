@@ -54,11 +54,28 @@ rdmapp::task<void> handle_qp(std::shared_ptr<rdmapp::queue_pair> qp)
 
 rdmapp::task<void> server(rdmapp::acceptor& acceptor)
 {
-   while (true) {
-      auto qp = co_await acceptor.accept();
-      handle_qp(qp).detach();
+   rdmapp::async_scope handlers;
+   std::exception_ptr error;
+   try {
+      while (true) {
+         auto qp = co_await acceptor.accept();
+         handlers.spawn(handle_qp(qp));
+         for (auto& exception : handlers.take_exceptions()) {
+            try {
+               std::rethrow_exception(exception);
+            }
+            catch (const std::exception& e) {
+               std::cerr << "Handler failed: " << e.what() << std::endl;
+            }
+         }
+      }
    }
-   co_return;
+   catch (...) {
+      // The running handlers refer to the scope, so it is joined below before the failure is rethrown.
+      error = std::current_exception();
+   }
+   co_await handlers.join();
+   std::rethrow_exception(error);
 }
 
 rdmapp::task<void> client(rdmapp::connector& connector)
@@ -3,18 +3,49 @@
 #include <arpa/inet.h>
 #include <rdmapp/device.h>
 #include <rdmapp/protected_domain.h>
+#include <rdmapp/qp_pool.h>
 #include <rdmapp/queue_pair.h>
 #include <sys/socket.h>
 
 #include <cstdint>
 #include <memory>
+#include <vector>
 
 #include "rdmapp/detail/util.h"
 #include "socket/channel.h"
+#include "socket/tcp_connection.h"
 #include "socket/tcp_listener.h"
 
 namespace rdmapp
 {
+   /**
+    * @brief This function is used to answer a Queue Pair exchange started by a connector.
+    *
+    * @param connection The TCP connection to the remote peer.
+    * @param pd The protection domain of the new Queue Pair.
+    * @param recv_cq The completion queue of recv work completions.
+    * @param send_cq The completion queue of send work completions.
+    * @param srq (Optional) If set, all recv work requests will be posted to this
+    * SRQ.
+    * @return task<std::shared_ptr<queue_pair>> A coroutine that returns a shared
+    * pointer to the new Queue Pair. It will be in the RTS state.
+    */
+   task<std::shared_ptr<queue_pair>> accept_qp(socket::tcp_connection& connection, std::shared_ptr<protected_domain> pd,
+                                               std::shared_ptr<completion_queue> recv_cq,
+                                               std::shared_ptr<completion_queue> send_cq,
+                                               std::shared_ptr<shared_receive_queue> srq = nullptr);
+
+   /**
+    * @brief This function is used to answer a Queue Pair exchange started by a connector with a Queue Pair taken from
+    * a pool.
+    *
+    * @param connection The TCP connection to the remote peer.
+    * @param pool The pool to take the Queue Pair from.
+    * @return task<std::shared_ptr<queue_pair>> A coroutine that returns a shared
+    * pointer to the Queue Pair. It will be in the RTS state.
+    */
+   task<std::shared_ptr<queue_pair>> accept_qp(socket::tcp_connection& connection, std::shared_ptr<qp_pool> pool);
+
    // This class is used to accept incoming connections and queue pairs.
    struct acceptor
    {
@@ -23,6 +54,10 @@ namespace rdmapp
       std::shared_ptr<completion_queue> recv_cq_;
       std::shared_ptr<completion_queue> send_cq_;
       std::shared_ptr<shared_receive_queue> srq_;
+      std::shared_ptr<qp_pool> pool_;
+
+      // Create the local side of a connection to a remote Queue Pair, in the RTS state.
+      std::shared_ptr<queue_pair> make_qp(const deserialized_qp::qp_header& remote);
 
      public:
       /**
@@ -84,6 +119,18 @@ namespace rdmapp
                std::shared_ptr<protected_domain> pd, std::shared_ptr<completion_queue> recv_cq,
                std::shared_ptr<completion_queue> send_cq, std::shared_ptr<shared_receive_queue> srq = nullptr);
 
+      /**
+       * @brief Construct a new acceptor object whose Queue Pairs are taken from a
+       * pool, which also sets their protection domain and completion queues.
+       *
+       * @param loop The event loop to use.
+       * @param hostname The hostname to listen on.
+       * @param port The port to listen on.
+       * @param pool The pool of Queue Pairs.
+       */
+      acceptor(std::shared_ptr<socket::event_loop> loop, const std::string& hostname, uint16_t port,
+               std::shared_ptr<qp_pool> pool);
+
       /**
        * @brief This function is used to accept an incoming connection and queue
        * pair. This should be called in a loop.
@@ -92,6 +139,16 @@ namespace rdmapp
        * pointer to the new queue pair. It will be in the RTS state.
        */
       task<std::shared_ptr<queue_pair>> accept();
+
+      /**
+       * @brief This function is used to accept an incoming connection carrying
+       * several queue pairs, sent by connector::connect_bundle().
+       *
+       * @return task<std::vector<std::shared_ptr<queue_pair>>> A completion task
+       * that returns one new queue pair per remote one, in the same order. They
+       * will be in the RTS state.
+       */
+      task<std::vector<std::shared_ptr<queue_pair>>> accept_bundle();
       ~acceptor();
    };
 }
\ No newline at end of file
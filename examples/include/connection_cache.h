@@ -0,0 +1,124 @@
+#pragma once
+
+#include <rdmapp/completion_queue.h>
+#include <rdmapp/protected_domain.h>
+#include <rdmapp/qp_pool.h>
+#include <rdmapp/queue_pair.h>
+#include <rdmapp/task.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "connector.h"
+#include "rdmapp/detail/util.h"
+#include "socket/event_loop.h"
+
+namespace rdmapp
+{
+   // The remote end of a cached connection.
+   struct endpoint
+   {
+      std::string hostname;
+      uint16_t port;
+      uint32_t tag; // Tells apart connections to the same host and port, such as those of different services.
+
+      bool operator==(const endpoint&) const = default;
+   };
+
+   struct endpoint_hash
+   {
+      size_t operator()(const endpoint& ep) const;
+   };
+
+   class pending_connection;
+
+   /**
+    * @brief This class is used to share connected Queue Pairs between the users of the same remote endpoint.
+    *
+    * A Queue Pair is connected on first use and handed to every later caller asking for the same endpoint. Callers
+    * that ask while the handshake is in flight wait for it instead of starting their own. Once max_connections Queue
+    * Pairs are cached, the least recently used one that nobody else holds is dropped to make room.
+    */
+   class connection_cache : public noncopyable
+   {
+      struct entry
+      {
+         std::shared_ptr<queue_pair> qp; // Null while connecting.
+         std::shared_ptr<pending_connection> pending; // Null once connected.
+         std::list<endpoint>::iterator lru; // Position in lru_, once connected.
+      };
+
+      std::shared_ptr<socket::event_loop> loop_;
+      std::shared_ptr<protected_domain> pd_;
+      std::shared_ptr<completion_queue> recv_cq_;
+      std::shared_ptr<completion_queue> send_cq_;
+      std::shared_ptr<shared_receive_queue> srq_;
+      std::shared_ptr<qp_pool> pool_;
+      size_t max_connections_;
+
+      std::mutex mutex_;
+      std::unordered_map<endpoint, entry, endpoint_hash> entries_;
+      std::list<endpoint> lru_; // Connected endpoints, most recently used first.
+
+      connector make_connector(const endpoint& ep) const;
+
+      // Called with the lock held. Returns false if every cached Queue Pair is in use.
+      bool make_room();
+
+     public:
+      /**
+       * @brief Construct a new connection cache object.
+       *
+       * @param loop The event loop to use.
+       * @param pd The protection domain of new Queue Pairs.
+       * @param recv_cq The recv completion queue of new Queue Pairs.
+       * @param send_cq The send completion queue of new Queue Pairs.
+       * @param srq (Optional) The shared receive queue of new Queue Pairs.
+       * @param max_connections The number of Queue Pairs kept, including those being connected.
+       */
+      connection_cache(std::shared_ptr<socket::event_loop> loop, std::shared_ptr<protected_domain> pd,
+                       std::shared_ptr<completion_queue> recv_cq, std::shared_ptr<completion_queue> send_cq,
+                       std::shared_ptr<shared_receive_queue> srq = nullptr, size_t max_connections = 64);
+
+      /**
+       * @brief Construct a new connection cache object whose Queue Pairs are taken from a pool.
+       *
+       * @param loop The event loop to use.
+       * @param pool The pool of Queue Pairs.
+       * @param max_connections The number of Queue Pairs kept, including those being connected.
+       */
+      connection_cache(std::shared_ptr<socket::event_loop> loop, std::shared_ptr<qp_pool> pool,
+                       size_t max_connections = 64);
+
+      /**
+       * @brief This function is used to get a Queue Pair connected to a remote endpoint, connecting one if none is
+       * cached or in flight. The remote must accept it with acceptor::accept().
+       *
+       * @param hostname The hostname to connect to.
+       * @param port The port to connect to.
+       * @param tag (Optional) Callers passing different tags get different Queue Pairs.
+       * @return task<std::shared_ptr<queue_pair>> The Queue Pair, in the RTS state. If the handshake fails, every
+       * caller waiting for it gets its exception, and the next call tries again. It also fails if the cache is full
+       * of Queue Pairs in use.
+       */
+      task<std::shared_ptr<queue_pair>> get(std::string hostname, uint16_t port, uint32_t tag = 0);
+
+      /**
+       * @brief This function is used to drop the cached Queue Pair of an endpoint, such as after it failed, so that
+       * the next get() connects a new one. Callers still holding it are not affected.
+       *
+       * @param hostname The hostname.
+       * @param port The port.
+       * @param tag The tag.
+       */
+      void evict(const std::string& hostname, uint16_t port, uint32_t tag = 0);
+
+      // The number of Queue Pairs cached or being connected.
+      size_t size();
+   };
+} // namespace rdmapp
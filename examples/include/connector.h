@@ -1,10 +1,13 @@
 #pragma once
 
 #include "socket/event_loop.h"
+#include <cstddef>
 #include <memory>
+#include <vector>
 
 #include <rdmapp/completion_queue.h>
 #include <rdmapp/protected_domain.h>
+#include <rdmapp/qp_pool.h>
 #include <rdmapp/queue_pair.h>
 #include <rdmapp/task.h>
 
@@ -25,6 +28,10 @@ class connector : public noncopyable {
   std::shared_ptr<socket::event_loop> loop_;
   std::string hostname_;
   uint16_t port_;
+  std::shared_ptr<qp_pool> pool_;
+
+  // Create a Queue Pair in the INIT state, taken from the pool if there is one.
+  std::shared_ptr<queue_pair> make_qp();
 
 public:
   /**
@@ -55,6 +62,19 @@ public:
             std::string const &hostname, uint16_t port, std::shared_ptr<protected_domain> pd,
             std::shared_ptr<completion_queue> cq, std::shared_ptr<shared_receive_queue> srq = nullptr);
 
+  /**
+   * @brief Construct a new connector object whose Queue Pairs are taken from a
+   * pool, which also sets their protection domain and completion queues.
+   *
+   * @param loop The event loop to use.
+   * @param hostname The hostname to connect to.
+   * @param port The port to connect to.
+   * @param pool The pool of Queue Pairs.
+   */
+  connector(std::shared_ptr<socket::event_loop> loop,
+            std::string const &hostname, uint16_t port,
+            std::shared_ptr<qp_pool> pool);
+
   /**
    * @brief This function is used to connect to a remote endpoint and establish
    * a Queue Pair.
@@ -62,6 +82,17 @@ public:
    * @return task<std::shared_ptr<qp>>
    */
   task<std::shared_ptr<queue_pair>> connect();
+
+  /**
+   * @brief This function is used to connect several Queue Pairs to the remote
+   * endpoint over one TCP connection, exchanging all of their descriptors in
+   * one message each way. The remote must call acceptor::accept_bundle().
+   *
+   * @param count The number of Queue Pairs.
+   * @return task<std::vector<std::shared_ptr<queue_pair>>> The Queue Pairs, in
+   * the RTS state. The i-th one is connected to the i-th one of the remote.
+   */
+  task<std::vector<std::shared_ptr<queue_pair>>> connect_bundle(size_t count);
 };
 
 } // namespace rdmapp
\ No newline at end of file
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <infiniband/verbs.h>
+#include <rdmapp/completion_queue.h>
+#include <rdmapp/timer_wheel.h>
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "rdmapp/detail/util.h"
+#include "socket/channel.h"
+#include "socket/event_loop.h"
+
+namespace rdmapp
+{
+   /**
+    * @brief Drives a completion queue from an event loop instead of a cq_poller and an executor. The CQ's completion
+    * channel is registered in the loop's epoll set alongside sockets, and completions are dispatched inline, so CQ
+    * draining, socket I/O and coroutine resumption all happen on the loop thread. Run one loop with its own CQ per core
+    * for a shared-nothing design.
+    *
+    * The reactor also has a timer wheel for operations awaited with_deadline() or with_timeout(), advanced on the loop
+    * thread by a one-shot timerfd armed for the next deadline, so an idle reactor has no timer wakeups.
+    */
+   class cq_reactor : public noncopyable
+   {
+      std::shared_ptr<completion_queue> cq_;
+      std::shared_ptr<socket::channel> channel_;
+      std::vector<ibv_wc> wc_vec_;
+      std::vector<completion_timestamp> ts_vec_;
+      std::shared_ptr<timer_wheel> timers_;
+      std::shared_ptr<socket::channel> timer_channel_;
+      std::mutex timer_mutex_;
+      std::optional<timer_wheel::clock::time_point> armed_; // The deadline the timerfd is armed for, if any.
+
+     public:
+      /**
+       * @brief Construct a new cq reactor object.
+       *
+       * @param loop The event loop to run on.
+       * @param cq The completion queue to drive. It must be created with events enabled.
+       * @param batch_size The number of completion entries to poll at a time.
+       * @param timer_resolution The tick of the timer wheel.
+       */
+      cq_reactor(std::shared_ptr<socket::event_loop> loop, std::shared_ptr<completion_queue> cq,
+                 size_t batch_size = 16, std::chrono::milliseconds timer_resolution = std::chrono::milliseconds(1));
+
+      // The timer wheel to pass to with_deadline() and with_timeout().
+      timer_wheel& timers() { return *timers_; }
+
+     private:
+      // Dispatch everything currently in the CQ.
+      void drain();
+
+      // Consume the pending events, re-arm the CQ and drain it.
+      void on_event();
+
+      // Arm the timerfd for a deadline, unless it is armed for an earlier one. Called from any thread.
+      void arm_timer(timer_wheel::clock::time_point deadline);
+
+      // Consume the timerfd expiration, fire the timers that are due and arm the timerfd for the next one.
+      void on_timer();
+   };
+} // namespace rdmapp
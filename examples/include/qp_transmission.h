@@ -5,10 +5,44 @@
 #include <rdmapp/queue_pair.h>
 #include <rdmapp/task.h>
 
+#include <memory>
+#include <vector>
+
 namespace rdmapp {
 
 task<deserialized_qp> recv_qp(socket::tcp_connection &connection);
 
 task<void> send_qp(queue_pair const &qp, socket::tcp_connection &connection);
 
+/**
+ * @brief Receive the descriptors of several Queue Pairs sent as one message.
+ *
+ * @param connection The TCP connection to the remote peer.
+ * @return task<std::vector<deserialized_qp>> The descriptors, in the order
+ * they were sent.
+ */
+task<std::vector<deserialized_qp>>
+recv_qps(socket::tcp_connection &connection);
+
+/**
+ * @brief Send the descriptors of several Queue Pairs as one message: a 32-bit
+ * count followed by each Queue Pair as send_qp() would send it.
+ *
+ * @param qps The Queue Pairs to send.
+ * @param connection The TCP connection to the remote peer.
+ */
+task<void> send_qps(std::vector<std::shared_ptr<queue_pair>> const &qps,
+                    socket::tcp_connection &connection);
+
+/**
+ * @brief Recover a Queue Pair that a work completion error moved to the error
+ * state, without a new handshake: drain it, reset it with a new PSN, exchange
+ * the PSNs as a 32-bit message each way and reconnect it to the same remote
+ * Queue Pair. The peer must call it at the same time on its end.
+ *
+ * @param qp The Queue Pair, connected before by the acceptor or connector.
+ * @param connection A TCP connection to the peer.
+ */
+task<void> recover_qp(queue_pair &qp, socket::tcp_connection &connection);
+
 } // namespace rdmapp
\ No newline at end of file
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <rdmapp/async_scope.h>
+#include <rdmapp/lazy_task.h>
+#include <rdmapp/queue_pair.h>
+#include <rdmapp/task.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "rdmapp/detail/util.h"
+#include "socket/event_loop.h"
+#include "socket/tcp_connection.h"
+#include "socket/tcp_listener.h"
+
+namespace rdmapp
+{
+   /**
+    * @brief This class accepts incoming Queue Pairs on several event loop threads.
+    *
+    * Every shard owns an event loop, the thread running it and a listener bound to the same port with SO_REUSEPORT,
+    * so the kernel spreads incoming connections across the shards. Each accepted connection runs its handshake as a
+    * task of its own, so a slow peer does not hold up the ones behind it. Connected Queue Pairs are handed to the
+    * coroutines waiting in accept(), in the order their handshakes complete.
+    */
+   class sharded_acceptor : public noncopyable
+   {
+     public:
+      /**
+       * @brief The server side of the handshake. It is called on the thread of the shard that accepted the
+       * connection, and may be replaced to test the acceptor without RDMA hardware.
+       */
+      using handshake_fn = std::function<task<std::shared_ptr<queue_pair>>(socket::tcp_connection&)>;
+
+      struct accept_awaitable
+      {
+         sharded_acceptor& acceptor_;
+         std::shared_ptr<queue_pair> qp_;
+         bool delivered_{};
+         std::coroutine_handle<> h_;
+         accept_awaitable(sharded_acceptor& acceptor);
+         bool await_ready() const noexcept;
+         bool await_suspend(std::coroutine_handle<> h);
+         std::shared_ptr<queue_pair> await_resume();
+      };
+
+     private:
+      struct shard
+      {
+         std::shared_ptr<socket::event_loop> loop;
+         std::unique_ptr<socket::tcp_listener> listener;
+         std::shared_ptr<socket::channel> backoff_timer; // A timerfd, armed after a failed accept.
+         std::thread thread;
+         std::coroutine_handle<> accept_loop;
+         async_scope handshakes;
+
+         std::mutex spawn_mutex;
+         std::condition_variable spawned;
+         bool stopping{}; // Set by shutdown(), after which no handshake is started.
+         size_t spawning{}; // Handshakes being spawned, which shutdown() waits for before joining the others.
+         std::mutex connections_mutex;
+         std::unordered_set<socket::channel*> connections; // Of the handshakes in flight.
+      };
+
+      // The first and the longest wait after a failed accept, such as on EMFILE.
+      static constexpr std::chrono::milliseconds kMinBackoff{10};
+      static constexpr std::chrono::milliseconds kMaxBackoff{1000};
+
+      handshake_fn handshake_;
+      std::vector<std::unique_ptr<shard>> shards_;
+
+      std::mutex mutex_;
+      bool closed_;
+      std::deque<std::shared_ptr<queue_pair>> ready_;
+      std::deque<accept_awaitable*> waiters_;
+
+      task<void> accept_loop(shard& s);
+      lazy_task<void> backoff(shard& s, std::chrono::milliseconds delay);
+      lazy_task<void> handshake(shard& s, std::shared_ptr<socket::channel> channel);
+      void deliver(std::shared_ptr<queue_pair> qp);
+
+     public:
+      /**
+       * @brief Construct a new sharded acceptor object.
+       *
+       * @param hostname The hostname to listen on.
+       * @param port The port to listen on.
+       * @param shards The number of listeners and event loop threads. 0 uses one per hardware thread.
+       * @param handshake The handshake to run on every accepted connection.
+       * @param backend The I/O backend of the event loops.
+       */
+      sharded_acceptor(const std::string& hostname, uint16_t port, size_t shards, handshake_fn handshake,
+                       socket::io_backend backend = socket::io_backend::epoll);
+
+      /**
+       * @brief Construct a new sharded acceptor object that answers connectors.
+       *
+       * @param hostname The hostname to listen on.
+       * @param port The port to listen on.
+       * @param shards The number of listeners and event loop threads. 0 uses one per hardware thread.
+       * @param pd The protection domain for all new Queue Pairs.
+       * @param recv_cq The recv completion queue to use for incoming Queue Pairs.
+       * @param send_cq The send completion queue to use for incoming Queue Pairs.
+       * @param srq (Optional) The shared receive queue to use for incoming Queue Pairs.
+       * @param backend The I/O backend of the event loops.
+       */
+      sharded_acceptor(const std::string& hostname, uint16_t port, size_t shards, std::shared_ptr<protected_domain> pd,
+                       std::shared_ptr<completion_queue> recv_cq, std::shared_ptr<completion_queue> send_cq,
+                       std::shared_ptr<shared_receive_queue> srq = nullptr,
+                       socket::io_backend backend = socket::io_backend::epoll);
+
+      size_t shards() const;
+
+      /**
+       * @brief Wait for the next connected Queue Pair. It may be awaited from any thread, and is resumed on the thread
+       * of the shard that completed the handshake.
+       *
+       * @return accept_awaitable An awaitable that returns a shared pointer to the new Queue Pair. It throws once the
+       * acceptor is shut down.
+       */
+      accept_awaitable accept();
+
+      /**
+       * @brief Stop accepting, wake all waiting accept() calls and join the shard threads. Queue Pairs that were
+       * connected but not yet accepted are released. The connections of handshakes in flight are shut down, and
+       * their handshakes waited for, so a custom handshake must fail once its connection does.
+       *
+       * It blocks until the shard threads exit, so it must be called from a thread that is not a shard thread, such as
+       * the one that constructed the acceptor. Coroutines resumed by accept() and handshakes run on shard threads:
+       * they must not call it, nor destroy the acceptor, but may signal another thread to do so.
+       */
+      void shutdown();
+
+      ~sharded_acceptor();
+   };
+} // namespace rdmapp
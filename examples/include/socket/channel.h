@@ -1,8 +1,12 @@
 #pragma once
 
+#include <atomic>
 #include <coroutine>
+#include <cstdint>
+#include <deque>
 #include <functional>
 #include <memory>
+#include <mutex>
 
 namespace rdmapp {
 namespace socket {
@@ -12,6 +16,11 @@ class event_loop;
 /**
  * @brief This class represents a pollable channel.
  *
+ * Readiness is cached per direction: the loop marks a direction ready when the
+ * fd reports it, and a waiter either consumes that readiness right away or
+ * parks until the next report. With epoll the fd is registered once,
+ * edge-triggered, for both directions.
+ *
  */
 class channel : public std::enable_shared_from_this<channel> {
 public:
@@ -24,18 +33,79 @@ private:
   callback_fn readable_callback_;
   callback_fn writable_callback_;
 
+  enum readiness : int { kNotReady, kReady, kWaiting };
+  std::atomic<int> readable_;
+  std::atomic<int> writable_;
+  std::atomic<bool> registered_; // Whether the fd is in the epoll set.
+  uint32_t generation_; // The generation of the registration in the loop.
+
+  bool arm(std::atomic<int> &state);
+  void notify(std::atomic<int> &state, callback_fn &callback);
+
+  // io_uring backend.
+  std::mutex accept_mutex_;
+  std::deque<int> accepted_;
+  std::coroutine_handle<> accept_waiter_;
+  bool accept_armed_;
+
+  friend class event_loop;
+
 public:
   static void set_nonblocking(int fd);
   channel(int fd, std::shared_ptr<event_loop> loop);
   int fd();
   void set_nonblocking();
-  void wait_readable();
-  void wait_writable();
+
+  /**
+   * @brief Wait for the fd to become readable. Set the readable callback
+   * first: it is called from the loop once the fd is readable, unless it
+   * already is.
+   *
+   * @return true If the callback will be called.
+   * @return false If the fd became readable since the last wait, retry the I/O
+   * instead.
+   */
+  bool wait_readable();
+
+  /**
+   * @brief Wait for the fd to become writable. See wait_readable().
+   *
+   */
+  bool wait_writable();
+
+  // Called by the loop when the fd reports readiness.
   void readable_callback();
   void writable_callback();
   void set_readable_callback(callback_fn &&callback);
   void set_writable_callback(callback_fn &&callback);
   std::shared_ptr<event_loop> loop();
+
+  /**
+   * @brief Hand over the result of a multishot accept (io_uring backend).
+   *
+   * @param fd The accepted fd, or a negative errno.
+   * @param more Whether the accept stays armed.
+   */
+  void accepted(int fd, bool more);
+
+  /**
+   * @brief Take the next result of the multishot accept.
+   *
+   * @param fd Set to the accepted fd, or to a negative errno.
+   * @return true If there was a result.
+   * @return false If nothing has been accepted yet.
+   */
+  bool pop_accepted(int &fd);
+
+  /**
+   * @brief Wait for the multishot accept to deliver a connection, arming it if
+   * needed.
+   *
+   * @param h The coroutine to resume once a result is queued.
+   * @return true If the coroutine should suspend.
+   * @return false If a result is already queued.
+   */
+  bool wait_accepted(std::coroutine_handle<> h);
   ~channel();
 };
 
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "rdmapp/detail/util.h"
+
+namespace rdmapp {
+namespace socket {
+
+class channel;
+
+/**
+ * @brief This class maps fds to the channels registered with an event loop.
+ *
+ * Slots are indexed by fd in lazily allocated segments that never move, so a
+ * lookup is two loads and does not take a lock. Every registration bumps the
+ * slot's generation, and events carry the generation they were registered
+ * with, so an event that was already queued for a closed channel is not
+ * delivered to the next channel that gets the same fd.
+ *
+ */
+class channel_table : public noncopyable {
+  static constexpr size_t kSegmentBits = 10;
+  static constexpr size_t kSegmentSize = size_t(1) << kSegmentBits;
+  static constexpr size_t kMaxSegments = 1024;
+
+  struct slot {
+    std::atomic<uint32_t> generation{};
+    std::atomic<std::weak_ptr<socket::channel>> target;
+  };
+
+  std::array<std::atomic<slot *>, kMaxSegments> segments_{};
+  std::mutex grow_mutex_; // Only taken to allocate a segment.
+
+  slot *find_slot(int fd);
+  slot &get_slot(int fd);
+
+public:
+  /**
+   * @brief Register a channel under its fd.
+   *
+   * @param fd The fd of the channel.
+   * @param channel The channel.
+   * @return uint32_t The generation of the registration, never 0.
+   */
+  uint32_t insert(int fd, std::shared_ptr<channel> channel);
+
+  /**
+   * @brief Remove a registration. Does nothing if the fd has been registered
+   * again since.
+   *
+   * @param fd The fd of the channel.
+   * @param generation The generation returned by insert().
+   */
+  void erase(int fd, uint32_t generation);
+
+  /**
+   * @brief Look up a live channel.
+   *
+   * @param fd The fd of the channel.
+   * @param generation The generation the event was registered with.
+   * @return std::shared_ptr<channel> The channel, or nullptr if it has been
+   * removed or destroyed.
+   */
+  std::shared_ptr<channel> find(int fd, uint32_t generation);
+
+  ~channel_table();
+};
+
+} // namespace socket
+} // namespace rdmapp
@@ -1,38 +1,122 @@
 #pragma once
 
 #include "socket/channel.h"
+#include "socket/channel_table.h"
+#include "socket/uring.h"
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <memory>
-#include <shared_mutex>
+#include <mutex>
 #include <sys/epoll.h>
-#include <unordered_map>
+#include <sys/uio.h>
+#include <thread>
+#include <vector>
 
 namespace rdmapp {
 namespace socket {
 
+/**
+ * @brief The mechanism an event loop uses to wait for I/O.
+ *
+ */
+enum class io_backend {
+  epoll,   // Readiness notification, one epoll_ctl per wait.
+  io_uring // Batched submissions, multishot accept and registered buffers.
+};
+
+/**
+ * @brief A read or write carried out by the io_uring backend. Its address is
+ * the user data of the submission, so completing it does not allocate.
+ *
+ */
+struct io_request {
+  using complete_fn = void (*)(io_request *self, int res);
+  complete_fn complete{}; // Called on the loop thread with the result.
+  int fd{-1};
+  bool write{};
+  void *buffer{};
+  size_t length{};
+  const struct iovec *iov{}; // Scatter/gather list replacing buffer, if set.
+  int iovcnt{};
+  int fixed_index{-1}; // The registered buffer staging the data, if any.
+};
+
 /**
  * @brief This class is a loop the drives asynchronous I/O.
  *
  */
 class event_loop {
+  static constexpr unsigned kRingEntries = 256;
+  static constexpr size_t kFixedBufferSize = 4096;
+  static constexpr size_t kFixedBuffers = 16;
+
+  const io_backend backend_;
   int epoll_fd_;
   int close_event_fd_;
   const size_t max_events_;
-  std::shared_mutex mutex;
-  std::unordered_map<int, std::weak_ptr<channel>> channels_;
+  channel_table channels_;
+
+  // io_uring backend. The submission ring is shared by all threads, but only
+  // the loop thread defers submissions until it next waits.
+  std::unique_ptr<uring> ring_;
+  std::mutex sq_mutex_;
+  std::atomic<std::thread::id> loop_thread_;
+  std::atomic<bool> multishot_accept_;
+  std::unique_ptr<char[]> fixed_buffers_;
+  std::vector<int> free_fixed_;
+
+  void epoll_loop();
 
-  void register_channel(std::shared_ptr<channel> channel,
-                        struct epoll_event *event);
+  void setup_uring();
+  void uring_loop();
+  bool handle_cqe(const struct io_uring_cqe &cqe);
+  struct io_uring_sqe *get_sqe(unsigned reserve = 1);
+  void submit_if_remote();
+  uint64_t track_channel(std::shared_ptr<channel> channel);
+  void submit_poll(std::shared_ptr<channel> channel, bool write);
+  void issue(io_request &request, bool after_poll);
+  void complete_request(io_request &request, int res);
 
 public:
-  event_loop(size_t max_events = 10);
-  static std::shared_ptr<event_loop> new_loop(size_t max_events = 10);
+  event_loop(size_t max_events = 10, io_backend backend = io_backend::epoll);
+  static std::shared_ptr<event_loop>
+  new_loop(size_t max_events = 10, io_backend backend = io_backend::epoll);
+  io_backend backend() const;
   void loop();
   void close();
+
+  /**
+   * @brief Add a channel to the epoll set, edge-triggered for both directions.
+   * It stays registered until it is destroyed. Does nothing if it is already
+   * registered.
+   *
+   * @param channel The channel to register.
+   */
+  void register_channel(std::shared_ptr<channel> channel);
+
+  // Wait for one readiness report (io_uring backend), or register the channel.
   void register_read(std::shared_ptr<channel> channel);
   void register_write(std::shared_ptr<channel> channel);
   void deregister(socket::channel &channel);
+
+  /**
+   * @brief Submit a read or write to the io_uring backend. Small transfers,
+   * vectored ones included, are staged through a registered buffer.
+   * request.complete is called on the loop thread with the number of bytes
+   * transferred or a negative errno.
+   *
+   * @param request The request. It must stay alive until completion.
+   */
+  void submit_io(io_request &request);
+
+  /**
+   * @brief Arm a multishot accept on a listening channel of the io_uring
+   * backend. Accepted connections are handed to channel::accepted().
+   *
+   * @param channel The listening channel.
+   */
+  void submit_accept(std::shared_ptr<channel> channel);
   ~event_loop();
 };
 
@@ -1,9 +1,11 @@
 #pragma once
 
 #include "socket/channel.h"
+#include "socket/event_loop.h"
 #include <cstdint>
 #include <memory>
 #include <netdb.h>
+#include <sys/uio.h>
 
 #include <rdmapp/task.h>
 
@@ -18,19 +20,28 @@ class tcp_connection {
   std::shared_ptr<channel> channel_;
 
 public:
-  class rw_awaitable {
+  class rw_awaitable : private io_request {
     std::shared_ptr<channel> channel_;
     void *buffer_;
+    const struct iovec *iov_;
+    int iovcnt_;
     int n_;
     size_t length_;
     bool write_;
+    int error_;
+    std::coroutine_handle<> h_;
     int do_io();
+    bool try_io();
+    bool uses_io_uring();
+    static void resume(io_request *self, int res);
 
   public:
     rw_awaitable(std::shared_ptr<channel> channel, bool write, void *buffer,
                  size_t length);
+    rw_awaitable(std::shared_ptr<channel> channel, bool write,
+                 const struct iovec *iov, int iovcnt);
     bool await_ready();
-    void await_suspend(std::coroutine_handle<> h);
+    bool await_suspend(std::coroutine_handle<> h);
     int await_resume();
   };
   class connect_awaitable {
@@ -41,7 +52,7 @@ public:
     connect_awaitable(std::shared_ptr<event_loop> loop,
                       std::string const &hostname, uint16_t port);
     bool await_ready();
-    void await_suspend(std::coroutine_handle<> h);
+    bool await_suspend(std::coroutine_handle<> h);
     std::shared_ptr<tcp_connection> await_resume();
   };
   static connect_awaitable connect(std::shared_ptr<event_loop> loop,
@@ -49,6 +60,27 @@ public:
   tcp_connection(std::shared_ptr<channel> channel);
   rw_awaitable recv(void *buffer, size_t length);
   rw_awaitable send(const void *buffer, size_t length);
+
+  /**
+   * @brief Read into several buffers with one system call.
+   *
+   * @param iov The buffers to fill in order. It must stay alive until the
+   * awaitable is resumed.
+   * @param iovcnt The number of buffers.
+   * @return rw_awaitable An awaitable that returns the number of bytes read.
+   */
+  rw_awaitable readv(const struct iovec *iov, int iovcnt);
+
+  /**
+   * @brief Write several buffers with one system call.
+   *
+   * @param iov The buffers to write in order. It must stay alive until the
+   * awaitable is resumed.
+   * @param iovcnt The number of buffers.
+   * @return rw_awaitable An awaitable that returns the number of bytes
+   * written.
+   */
+  rw_awaitable writev(const struct iovec *iov, int iovcnt);
 };
 
 } // namespace socket
@@ -20,16 +20,29 @@ public:
     std::shared_ptr<channel> channel_;
     void *buffer_;
     int client_fd_;
+    bool popped_; // Whether client_fd_ holds a result of the multishot accept.
+    int error_;
+    std::coroutine_handle<> h_;
     int do_io();
+    bool try_accept();
 
   public:
     accept_awaitable(std::shared_ptr<channel> channel);
     bool await_ready();
-    void await_suspend(std::coroutine_handle<> h);
+    bool await_suspend(std::coroutine_handle<> h);
     std::shared_ptr<channel> await_resume();
   };
+  /**
+   * @brief Construct a new tcp listener object.
+   *
+   * @param loop The event loop to use.
+   * @param hostname The hostname to listen on.
+   * @param port The port to listen on.
+   * @param reuse_port Set SO_REUSEPORT, so that several listeners can share the
+   * port and the kernel spreads incoming connections across them.
+   */
   tcp_listener(std::shared_ptr<event_loop> loop, std::string const &hostname,
-               uint16_t port);
+               uint16_t port, bool reuse_port = false);
   accept_awaitable accept();
 };
 
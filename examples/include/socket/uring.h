@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+#include "rdmapp/detail/util.h"
+
+namespace rdmapp {
+namespace socket {
+
+/**
+ * @brief This class is a minimal io_uring instance driven through the raw
+ * system calls. It does not lock: the owner serializes access to the
+ * submission ring, while the completion ring is only read by the thread that
+ * drives it.
+ *
+ */
+class uring : public noncopyable {
+  int fd_;
+  unsigned *sq_head_;
+  unsigned *sq_tail_;
+  unsigned *sq_mask_;
+  unsigned *sq_array_;
+  unsigned *cq_head_;
+  unsigned *cq_tail_;
+  unsigned *cq_mask_;
+  struct io_uring_sqe *sqes_;
+  struct io_uring_cqe *cqes_;
+  unsigned sq_entries_;
+  unsigned sqe_tail_;
+  void *sq_ring_;
+  size_t sq_ring_size_;
+  void *cq_ring_;
+  size_t cq_ring_size_;
+  size_t sqes_size_;
+
+public:
+  /**
+   * @brief Construct a new uring object.
+   *
+   * @param entries The number of submission queue entries. The kernel sizes the
+   * completion queue to twice as many.
+   */
+  uring(unsigned entries);
+
+  int fd() const;
+
+  /**
+   * @brief The number of entries that can still be prepared before the
+   * submission ring has to be flushed to the kernel.
+   *
+   */
+  unsigned space_left() const;
+
+  /**
+   * @brief Get a zeroed submission queue entry to fill in. It is not visible
+   * to the kernel until flush() is called.
+   *
+   * @return struct io_uring_sqe* The entry, or nullptr if the ring is full.
+   */
+  struct io_uring_sqe *get_sqe();
+
+  /**
+   * @brief Publish the prepared entries.
+   *
+   * @return unsigned The number of entries the kernel has not consumed yet.
+   */
+  unsigned flush();
+
+  /**
+   * @brief Submit entries and optionally wait for completions.
+   *
+   * @param to_submit The number of entries to submit.
+   * @param min_complete The number of completions to wait for.
+   * @return int The number of entries consumed, or -1 with errno set.
+   */
+  int enter(unsigned to_submit, unsigned min_complete);
+
+  /**
+   * @brief Register fixed buffers for IORING_OP_READ_FIXED and
+   * IORING_OP_WRITE_FIXED.
+   *
+   * @return int 0 on success, or -1 with errno set.
+   */
+  int register_buffers(const struct iovec *iovecs, unsigned nr_iovecs);
+
+  /**
+   * @brief Consume the available completion entries.
+   *
+   * @param fn Called with a copy of each entry. The entry is released before
+   * the call, so fn may prepare new submissions.
+   */
+  template <class Fn> void for_each_cqe(Fn &&fn) {
+    auto head = *cq_head_;
+    while (head != std::atomic_ref(*cq_tail_).load(std::memory_order_acquire)) {
+      auto cqe = cqes_[head & *cq_mask_];
+      std::atomic_ref(*cq_head_).store(++head, std::memory_order_release);
+      fn(cqe);
+    }
+  }
+
+  ~uring();
+};
+
+} // namespace socket
+} // namespace rdmapp
@@ -1,47 +1,78 @@
 #include "qp_transmission.h"
 
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+#include "rdmapp/lazy_task.h"
+
 namespace rdmapp
 {
+   // The initial buffer of a bundle, room for the count and a few headers.
+   static constexpr size_t kInlineQpSize = 256;
+
+   // Bounds the allocation a corrupt bundle count could cause.
+   static constexpr uint32_t kMaxQpBundle = 4096;
+
    task<void> send_qp(const queue_pair& qp, socket::tcp_connection& connection)
    {
-      auto local_qp_data = qp.serialize();
-      assert(local_qp_data.size() != 0);
-      size_t local_qp_sent = 0;
-      while (local_qp_sent < local_qp_data.size()) {
-         int n = co_await connection.send(&local_qp_data[local_qp_sent], local_qp_data.size() - local_qp_sent);
+      uint8_t header[deserialized_qp::qp_header::kSerializedSize];
+      qp.serialize_header(header);
+      auto const& user_data = qp.user_data();
+      struct iovec iov[2] = {{header, sizeof(header)},
+                             {const_cast<uint8_t*>(user_data.data()), user_data.size()}};
+      struct iovec* pending = iov;
+      int pending_count = user_data.empty() ? 1 : 2;
+      while (pending_count > 0) {
+         int n = co_await connection.writev(pending, pending_count);
          if (n == 0) {
             throw_with("remote closed unexpectedly while sending qp");
          }
          check_errno(n, "failed to send qp");
-         local_qp_sent += n;
+         // Drop what has been written, usually everything.
+         size_t sent = n;
+         while (pending_count > 0 && sent >= pending->iov_len) {
+            sent -= pending->iov_len;
+            ++pending;
+            --pending_count;
+         }
+         if (pending_count > 0) {
+            pending->iov_base = static_cast<uint8_t*>(pending->iov_base) + sent;
+            pending->iov_len -= sent;
+         }
       }
       co_return;
    }
 
    task<deserialized_qp> recv_qp(socket::tcp_connection& connection)
    {
+      constexpr size_t kHeaderSize = deserialized_qp::qp_header::kSerializedSize;
+      // Exactly the header, then exactly the user data it announces, so whatever the peer sends next stays unread.
+      uint8_t header[kHeaderSize];
       size_t header_read = 0;
-      uint8_t header[deserialized_qp::qp_header::kSerializedSize];
-      while (header_read < deserialized_qp::qp_header::kSerializedSize) {
-         int n =
-            co_await connection.recv(&header[header_read], deserialized_qp::qp_header::kSerializedSize - header_read);
+      while (header_read < kHeaderSize) {
+         int n = co_await connection.recv(&header[header_read], kHeaderSize - header_read);
          if (n == 0) {
             throw_with("remote closed unexpectedly while receiving qp header");
          }
+         check_errno(n, "failed to receive qp header");
          header_read += n;
       }
 
       auto remote_qp = deserialized_qp::deserialize(header);
       RDMAPP_LOG_TRACE("received header lid=%u qpn=%u psn=%u user_data_size=%u", remote_qp.header.lid,
                        remote_qp.header.qp_num, remote_qp.header.sq_psn, remote_qp.header.user_data_size);
-      remote_qp.user_data.resize(remote_qp.header.user_data_size);
-
-      if (remote_qp.header.user_data_size > 0) {
+      size_t user_data_size = remote_qp.header.user_data_size;
+      if (user_data_size > 0) {
+         remote_qp.user_data.resize(user_data_size);
          size_t user_data_read = 0;
-         remote_qp.user_data.resize(remote_qp.header.user_data_size, 0);
-         while (user_data_read < remote_qp.header.user_data_size) {
-            int n = co_await connection.recv(&remote_qp.user_data[user_data_read],
-                                             remote_qp.header.user_data_size - user_data_read);
+         while (user_data_read < user_data_size) {
+            int n = co_await connection.recv(&remote_qp.user_data[user_data_read], user_data_size - user_data_read);
             if (n == 0) {
                throw_with("remote closed unexpectedly while receiving user data");
             }
@@ -53,4 +84,106 @@ namespace rdmapp
       co_return remote_qp;
    }
 
+   task<void> send_qps(const std::vector<std::shared_ptr<queue_pair>>& qps, socket::tcp_connection& connection)
+   {
+      std::vector<uint8_t> message;
+      auto it = std::back_inserter(message);
+      detail::serialize(static_cast<uint32_t>(qps.size()), it);
+      for (auto const& qp : qps) {
+         auto offset = message.size();
+         message.resize(offset + deserialized_qp::qp_header::kSerializedSize);
+         qp->serialize_header(&message[offset]);
+         message.insert(message.end(), qp->user_data().begin(), qp->user_data().end());
+      }
+      size_t message_sent = 0;
+      while (message_sent < message.size()) {
+         int n = co_await connection.send(&message[message_sent], message.size() - message_sent);
+         if (n == 0) {
+            throw_with("remote closed unexpectedly while sending qps");
+         }
+         check_errno(n, "failed to send qps");
+         message_sent += n;
+      }
+      co_return;
+   }
+
+   // Read until exactly `needed` bytes of the message are buffered, never into the message that follows it.
+   static lazy_task<void> recv_until(socket::tcp_connection& connection, std::vector<uint8_t>& buffer,
+                                     size_t& buffer_read, size_t needed)
+   {
+      if (buffer.size() < needed) {
+         buffer.resize(std::max(needed, buffer.size() * 2));
+      }
+      while (buffer_read < needed) {
+         int n = co_await connection.recv(&buffer[buffer_read], needed - buffer_read);
+         if (n == 0) {
+            throw_with("remote closed unexpectedly while receiving qps");
+         }
+         check_errno(n, "failed to receive qps");
+         buffer_read += n;
+      }
+      co_return;
+   }
+
+   task<std::vector<deserialized_qp>> recv_qps(socket::tcp_connection& connection)
+   {
+      constexpr size_t kHeaderSize = deserialized_qp::qp_header::kSerializedSize;
+      std::vector<uint8_t> buffer(kInlineQpSize);
+      size_t buffer_read = 0;
+      co_await recv_until(connection, buffer, buffer_read, sizeof(uint32_t));
+      auto it = buffer.cbegin();
+      uint32_t count;
+      detail::deserialize(it, count);
+      if (count > kMaxQpBundle) {
+         throw_with("qp bundle of %u exceeds the limit of %u", count, kMaxQpBundle);
+      }
+
+      std::vector<deserialized_qp> remote_qps;
+      remote_qps.reserve(count);
+      size_t offset = sizeof(uint32_t);
+      for (uint32_t i = 0; i < count; ++i) {
+         co_await recv_until(connection, buffer, buffer_read, offset + kHeaderSize);
+         auto remote_qp = deserialized_qp::deserialize(&buffer[offset]);
+         offset += kHeaderSize;
+         size_t user_data_size = remote_qp.header.user_data_size;
+         co_await recv_until(connection, buffer, buffer_read, offset + user_data_size);
+         remote_qp.user_data.assign(&buffer[offset], &buffer[offset] + user_data_size);
+         offset += user_data_size;
+         remote_qps.push_back(std::move(remote_qp));
+      }
+      RDMAPP_LOG_TRACE("received %u qps", count);
+      co_return remote_qps;
+   }
+
+   task<void> recover_qp(queue_pair& qp, socket::tcp_connection& connection)
+   {
+      co_await qp.drain();
+      uint8_t message[sizeof(uint32_t)];
+      auto out = &message[0];
+      detail::serialize(qp.prepare_recovery(), out);
+      size_t message_sent = 0;
+      while (message_sent < sizeof(message)) {
+         int n = co_await connection.send(&message[message_sent], sizeof(message) - message_sent);
+         if (n == 0) {
+            throw_with("remote closed unexpectedly while sending psn");
+         }
+         check_errno(n, "failed to send psn");
+         message_sent += n;
+      }
+      size_t message_read = 0;
+      while (message_read < sizeof(message)) {
+         int n = co_await connection.recv(&message[message_read], sizeof(message) - message_read);
+         if (n == 0) {
+            throw_with("remote closed unexpectedly while receiving psn");
+         }
+         check_errno(n, "failed to receive psn");
+         message_read += n;
+      }
+      auto in = &message[0];
+      uint32_t remote_psn;
+      detail::deserialize(in, remote_psn);
+      qp.recover(remote_psn);
+      co_return;
+   }
+
 } // namespace rdmapp
\ No newline at end of file
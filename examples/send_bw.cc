@@ -7,8 +7,10 @@
 #include <iostream>
 #include <memory>
 #include <ratio>
+#include <stdexcept>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "acceptor.h"
 #include "connector.h"
@@ -44,18 +46,18 @@ rdmapp::task<void> worker(size_t id, std::shared_ptr<rdmapp::queue_pair> qp)
 }
 
 template <bool Client = false>
-rdmapp::task<void> handler(std::shared_ptr<rdmapp::queue_pair> qp)
+rdmapp::task<void> handler(std::vector<std::shared_ptr<rdmapp::queue_pair>> qps)
 {
-   std::vector<std::future<void>*> futures;
-   for (size_t i = 0; i < kWorkerCount; ++i) {
-      auto task = worker<Client>(i, qp);
-      futures.emplace_back(&task.get_future());
-      task.detach();
+   if (qps.size() != kWorkerCount) {
+      // The peer decides how many QPs a bundle holds.
+      throw std::runtime_error("Expected " + std::to_string(kWorkerCount) + " qps, got " + std::to_string(qps.size()));
    }
    auto tik = std::chrono::high_resolution_clock::now();
-   for (auto fut : futures) {
-      fut->get();
+   std::vector<rdmapp::task<void>> workers;
+   for (size_t i = 0; i < kWorkerCount; ++i) {
+      workers.push_back(worker<Client>(i, qps[i]));
    }
+   co_await rdmapp::when_all(std::move(workers));
    auto tok = std::chrono::high_resolution_clock::now();
    std::chrono::duration<double> seconds = tok - tik;
    double mb = static_cast<double>(kTotalSizeBytes) / 1024 / 1024;
@@ -67,15 +69,16 @@ rdmapp::task<void> handler(std::shared_ptr<rdmapp::queue_pair> qp)
 
 rdmapp::task<void> server(rdmapp::acceptor& acceptor)
 {
-   auto qp = co_await acceptor.accept();
-   co_await handler(qp);
+   // One QP per worker, all set up over a single TCP connection.
+   auto qps = co_await acceptor.accept_bundle();
+   co_await handler(qps);
    co_return;
 }
 
 rdmapp::task<void> client(rdmapp::connector& connector)
 {
-   auto qp = co_await connector.connect();
-   co_await handler<true>(qp);
+   auto qps = co_await connector.connect_bundle(kWorkerCount);
+   co_await handler<true>(qps);
    co_return;
 }
 
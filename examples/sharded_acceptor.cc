@@ -0,0 +1,256 @@
+#include "sharded_acceptor.h"
+
+#include <rdmapp/detail/debug.h>
+#include <rdmapp/error.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "acceptor.h"
+#include "socket/channel.h"
+
+namespace rdmapp
+{
+
+   sharded_acceptor::accept_awaitable::accept_awaitable(sharded_acceptor& acceptor) : acceptor_(acceptor) {}
+
+   bool sharded_acceptor::accept_awaitable::await_ready() const noexcept { return false; }
+
+   bool sharded_acceptor::accept_awaitable::await_suspend(std::coroutine_handle<> h)
+   {
+      std::lock_guard lock(acceptor_.mutex_);
+      if (!acceptor_.ready_.empty()) {
+         qp_ = std::move(acceptor_.ready_.front());
+         acceptor_.ready_.pop_front();
+         delivered_ = true;
+         return false;
+      }
+      if (acceptor_.closed_) {
+         return false;
+      }
+      h_ = h;
+      acceptor_.waiters_.push_back(this);
+      return true;
+   }
+
+   std::shared_ptr<queue_pair> sharded_acceptor::accept_awaitable::await_resume()
+   {
+      if (!delivered_) {
+         throw_with("acceptor is shut down");
+      }
+      return std::move(qp_);
+   }
+
+   sharded_acceptor::sharded_acceptor(const std::string& hostname, uint16_t port, size_t shards,
+                                      handshake_fn handshake, socket::io_backend backend)
+      : handshake_(std::move(handshake)), closed_(false)
+   {
+      if (shards == 0) {
+         shards = std::max(1u, std::thread::hardware_concurrency());
+      }
+      for (size_t i = 0; i < shards; ++i) {
+         auto s = std::make_unique<shard>();
+         s->loop = socket::event_loop::new_loop(64, backend);
+         s->listener = std::make_unique<socket::tcp_listener>(s->loop, hostname, port, true);
+         int timer_fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+         check_errno(timer_fd, "failed to create backoff timer");
+         s->backoff_timer = std::make_shared<socket::channel>(timer_fd, s->loop);
+         shards_.push_back(std::move(s));
+      }
+      for (auto& s : shards_) {
+         auto accepting = accept_loop(*s);
+         s->accept_loop = accepting.h_;
+         accepting.detach();
+         s->thread = std::thread([loop = s->loop]() { loop->loop(); });
+      }
+      RDMAPP_LOG_DEBUG("sharded acceptor listening on %d with %zu shards", port, shards_.size());
+   }
+
+   sharded_acceptor::sharded_acceptor(const std::string& hostname, uint16_t port, size_t shards,
+                                      std::shared_ptr<protected_domain> pd, std::shared_ptr<completion_queue> recv_cq,
+                                      std::shared_ptr<completion_queue> send_cq,
+                                      std::shared_ptr<shared_receive_queue> srq, socket::io_backend backend)
+      : sharded_acceptor(
+           hostname, port, shards,
+           [pd, recv_cq, send_cq, srq](socket::tcp_connection& connection) {
+              return accept_qp(connection, pd, recv_cq, send_cq, srq);
+           },
+           backend)
+   {}
+
+   size_t sharded_acceptor::shards() const { return shards_.size(); }
+
+   task<void> sharded_acceptor::accept_loop(shard& s)
+   {
+      auto delay = kMinBackoff;
+      while (true) {
+         std::shared_ptr<socket::channel> channel;
+         try {
+            channel = co_await s.listener->accept();
+         }
+         catch (std::exception& e) {
+            RDMAPP_LOG_ERROR("failed to accept, retrying in %lld ms: %s", static_cast<long long>(delay.count()),
+                             e.what());
+         }
+         if (channel == nullptr) {
+            // Errors such as EMFILE last until descriptors are freed, and the listener stays readable meanwhile.
+            co_await backoff(s, delay);
+            delay = std::min(delay * 2, kMaxBackoff);
+            continue;
+         }
+         delay = kMinBackoff;
+         {
+            std::lock_guard lock(s.spawn_mutex);
+            if (s.stopping) {
+               continue;
+            }
+            ++s.spawning;
+         }
+         {
+            std::lock_guard lock(s.connections_mutex);
+            s.connections.insert(channel.get());
+         }
+         // The handshake may complete, and resume an accept() waiter, before spawn() returns, so no lock is held.
+         s.handshakes.spawn(handshake(s, std::move(channel)));
+         {
+            std::lock_guard lock(s.spawn_mutex);
+            --s.spawning;
+         }
+         s.spawned.notify_all();
+      }
+   }
+
+   namespace
+   {
+      // Resumes a coroutine once a channel is readable, or right away if it already is.
+      struct readable_awaitable
+      {
+         socket::channel& channel_;
+         std::coroutine_handle<> h_;
+
+         bool await_ready() const noexcept { return false; }
+
+         bool await_suspend(std::coroutine_handle<> h)
+         {
+            h_ = h;
+            channel_.set_readable_callback([this]() { h_.resume(); });
+            return channel_.wait_readable();
+         }
+
+         void await_resume() const noexcept {}
+      };
+
+      lazy_task<void> join_scope(async_scope& scope) { co_await scope.join(); }
+   } // namespace
+
+   lazy_task<void> sharded_acceptor::backoff(shard& s, std::chrono::milliseconds delay)
+   {
+      struct itimerspec spec = {};
+      spec.it_value.tv_sec = delay.count() / 1000;
+      spec.it_value.tv_nsec = (delay.count() % 1000) * 1000000;
+      int fd = s.backoff_timer->fd();
+      if (::timerfd_settime(fd, 0, &spec, nullptr) != 0) [[unlikely]] {
+         RDMAPP_LOG_ERROR("failed to arm backoff timer: %s", strerror(errno));
+         co_return;
+      }
+      uint64_t expirations;
+      while (::read(fd, &expirations, sizeof(expirations)) < 0) {
+         if (errno != EAGAIN) [[unlikely]] {
+            RDMAPP_LOG_ERROR("failed to read backoff timer: %s", strerror(errno));
+            co_return;
+         }
+         co_await readable_awaitable{*s.backoff_timer, nullptr};
+      }
+   }
+
+   lazy_task<void> sharded_acceptor::handshake(shard& s, std::shared_ptr<socket::channel> channel)
+   {
+      try {
+         socket::tcp_connection connection(channel);
+         deliver(co_await handshake_(connection));
+      }
+      catch (std::exception& e) {
+         RDMAPP_LOG_ERROR("handshake failed: %s", e.what());
+      }
+      // The descriptor is closed with the channel, after shutdown() can no longer see it.
+      std::lock_guard lock(s.connections_mutex);
+      s.connections.erase(channel.get());
+   }
+
+   void sharded_acceptor::deliver(std::shared_ptr<queue_pair> qp)
+   {
+      std::unique_lock lock(mutex_);
+      if (closed_) {
+         return;
+      }
+      if (waiters_.empty()) {
+         ready_.push_back(std::move(qp));
+         return;
+      }
+      auto waiter = waiters_.front();
+      waiters_.pop_front();
+      lock.unlock();
+      waiter->qp_ = std::move(qp);
+      waiter->delivered_ = true;
+      waiter->h_.resume();
+   }
+
+   sharded_acceptor::accept_awaitable sharded_acceptor::accept() { return accept_awaitable(*this); }
+
+   void sharded_acceptor::shutdown()
+   {
+      std::deque<accept_awaitable*> waiters;
+      {
+         std::lock_guard lock(mutex_);
+         if (closed_) {
+            return;
+         }
+         closed_ = true;
+         waiters.swap(waiters_);
+         ready_.clear();
+      }
+      // Fail the handshakes in flight and wait for them, while the loops still run them.
+      for (auto& s : shards_) {
+         {
+            std::unique_lock lock(s->spawn_mutex);
+            s->stopping = true;
+            s->spawned.wait(lock, [&s]() { return s->spawning == 0; });
+         }
+         std::lock_guard lock(s->connections_mutex);
+         for (auto connection : s->connections) {
+            ::shutdown(connection->fd(), SHUT_RDWR);
+         }
+      }
+      for (auto& s : shards_) {
+         sync_wait(join_scope(s->handshakes));
+      }
+      for (auto& s : shards_) {
+         s->loop->close();
+      }
+      for (auto& s : shards_) {
+         if (s->thread.joinable()) {
+            s->thread.join();
+         }
+         // The accept loop never finishes, and nothing resumes it once the loop has stopped.
+         s->accept_loop.destroy();
+      }
+      for (auto waiter : waiters) {
+         waiter->h_.resume();
+      }
+   }
+
+   sharded_acceptor::~sharded_acceptor() { shutdown(); }
+
+} // namespace rdmapp
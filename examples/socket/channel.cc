@@ -7,7 +7,9 @@
 #include <fcntl.h>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <unistd.h>
+#include <utility>
 
 #include <rdmapp/detail/debug.h>
 #include <rdmapp/detail/util.h>
@@ -18,7 +20,9 @@ namespace socket {
 
 channel::channel(int fd, std::shared_ptr<event_loop> loop)
     : fd_(fd), loop_(loop), readable_callback_(noop_callback),
-      writable_callback_(noop_callback) {}
+      writable_callback_(noop_callback), readable_(kNotReady),
+      writable_(kNotReady), registered_(false), generation_(0),
+      accept_armed_(false) {}
 
 int channel::fd() { return fd_; }
 
@@ -33,22 +37,68 @@ void channel::set_nonblocking(int fd) {
 
 void channel::set_nonblocking() { set_nonblocking(fd_); }
 
-void channel::writable_callback() {
-  loop_->deregister(*this);
-  writable_callback_();
+bool channel::arm(std::atomic<int> &state) {
+  int expected = kNotReady;
+  if (state.compare_exchange_strong(expected, kWaiting,
+                                    std::memory_order_acq_rel)) {
+    return true;
+  }
+  // Consume the cached readiness. The loop only ever keeps a ready state
+  // ready, and an edge racing with this store is covered by the retried I/O.
+  assert(expected == kReady);
+  state.store(kNotReady, std::memory_order_relaxed);
+  return false;
 }
 
-void channel::readable_callback() {
-  loop_->deregister(*this);
-  readable_callback_();
+void channel::notify(std::atomic<int> &state, callback_fn &callback) {
+  auto current = state.load(std::memory_order_acquire);
+  while (true) {
+    // A parked waiter takes the readiness with it.
+    auto next = current == kWaiting ? kNotReady : kReady;
+    if (state.compare_exchange_weak(current, next, std::memory_order_acq_rel,
+                                    std::memory_order_acquire)) {
+      break;
+    }
+  }
+  if (current == kWaiting) {
+    callback();
+  }
 }
 
-void channel::wait_readable() {
-  loop_->register_read(this->shared_from_this());
+void channel::writable_callback() { notify(writable_, writable_callback_); }
+
+void channel::readable_callback() { notify(readable_, readable_callback_); }
+
+bool channel::wait_readable() {
+  if (loop_->backend() == io_backend::epoll) {
+    if (!registered_.load(std::memory_order_acquire)) {
+      loop_->register_channel(this->shared_from_this());
+    }
+    // Once armed, the loop may run the callback at any time, and the callback
+    // may drop the last reference to this channel.
+    return arm(readable_);
+  }
+  auto self = this->shared_from_this();
+  if (!arm(readable_)) {
+    return false;
+  }
+  loop_->register_read(self);
+  return true;
 }
 
-void channel::wait_writable() {
-  loop_->register_write(this->shared_from_this());
+bool channel::wait_writable() {
+  if (loop_->backend() == io_backend::epoll) {
+    if (!registered_.load(std::memory_order_acquire)) {
+      loop_->register_channel(this->shared_from_this());
+    }
+    return arm(writable_);
+  }
+  auto self = this->shared_from_this();
+  if (!arm(writable_)) {
+    return false;
+  }
+  loop_->register_write(self);
+  return true;
 }
 
 void channel::set_writable_callback(callback_fn &&callback) {
@@ -61,8 +111,56 @@ void channel::set_readable_callback(callback_fn &&callback) {
 
 std::shared_ptr<event_loop> channel::loop() { return loop_; }
 
+void channel::accepted(int fd, bool more) {
+  std::coroutine_handle<> waiter;
+  {
+    std::lock_guard lock(accept_mutex_);
+    if (fd != -ECANCELED) {
+      accepted_.push_back(fd);
+    }
+    accept_armed_ = more;
+    if (!accepted_.empty()) {
+      waiter = std::exchange(accept_waiter_, nullptr);
+    }
+  }
+  if (waiter) {
+    waiter.resume();
+  }
+}
+
+bool channel::pop_accepted(int &fd) {
+  std::lock_guard lock(accept_mutex_);
+  if (accepted_.empty()) {
+    return false;
+  }
+  fd = accepted_.front();
+  accepted_.pop_front();
+  return true;
+}
+
+bool channel::wait_accepted(std::coroutine_handle<> h) {
+  {
+    std::lock_guard lock(accept_mutex_);
+    if (!accepted_.empty()) {
+      return false;
+    }
+    accept_waiter_ = h;
+    if (accept_armed_) {
+      return true;
+    }
+    accept_armed_ = true;
+  }
+  loop_->submit_accept(this->shared_from_this());
+  return true;
+}
+
 channel::~channel() {
   loop_->deregister(*this);
+  for (auto fd : accepted_) {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
   assert(fd_ > 0);
   if (auto rc = ::close(fd_); rc != 0) [[unlikely]] {
     RDMAPP_LOG_ERROR("failed to close fd %d: %s (errno=%d)", fd_,
@@ -0,0 +1,86 @@
+#include "socket/channel_table.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include <rdmapp/error.h>
+
+namespace rdmapp {
+namespace socket {
+
+channel_table::slot *channel_table::find_slot(int fd) {
+  auto index = static_cast<size_t>(fd);
+  if (fd < 0 || (index >> kSegmentBits) >= kMaxSegments) [[unlikely]] {
+    return nullptr;
+  }
+  auto segment =
+      segments_[index >> kSegmentBits].load(std::memory_order_acquire);
+  if (segment == nullptr) {
+    return nullptr;
+  }
+  return &segment[index & (kSegmentSize - 1)];
+}
+
+channel_table::slot &channel_table::get_slot(int fd) {
+  auto index = static_cast<size_t>(fd);
+  if (fd < 0 || (index >> kSegmentBits) >= kMaxSegments) [[unlikely]] {
+    throw_with("fd %d out of range of the channel table", fd);
+  }
+  auto &segment = segments_[index >> kSegmentBits];
+  auto slots = segment.load(std::memory_order_acquire);
+  if (slots == nullptr) {
+    std::lock_guard lock(grow_mutex_);
+    slots = segment.load(std::memory_order_relaxed);
+    if (slots == nullptr) {
+      slots = new slot[kSegmentSize];
+      segment.store(slots, std::memory_order_release);
+    }
+  }
+  return slots[index & (kSegmentSize - 1)];
+}
+
+uint32_t channel_table::insert(int fd, std::shared_ptr<channel> channel) {
+  auto &slot = get_slot(fd);
+  // Publish the channel before the generation that makes it visible.
+  slot.target.store(channel, std::memory_order_release);
+  auto generation = slot.generation.load(std::memory_order_relaxed) + 1;
+  if (generation == 0) {
+    ++generation;
+  }
+  slot.generation.store(generation, std::memory_order_release);
+  return generation;
+}
+
+void channel_table::erase(int fd, uint32_t generation) {
+  auto slot = find_slot(fd);
+  if (slot == nullptr ||
+      slot->generation.load(std::memory_order_acquire) != generation) {
+    return;
+  }
+  // Invalidate the generation first, so lookups racing with the reset fail.
+  slot->generation.store(generation + 1, std::memory_order_release);
+  slot->target.store(std::weak_ptr<channel>(), std::memory_order_release);
+}
+
+std::shared_ptr<channel> channel_table::find(int fd, uint32_t generation) {
+  auto slot = find_slot(fd);
+  if (slot == nullptr ||
+      slot->generation.load(std::memory_order_acquire) != generation) {
+    return nullptr;
+  }
+  auto channel = slot->target.load(std::memory_order_acquire).lock();
+  if (slot->generation.load(std::memory_order_acquire) != generation) {
+    return nullptr;
+  }
+  return channel;
+}
+
+channel_table::~channel_table() {
+  for (auto &segment : segments_) {
+    delete[] segment.load(std::memory_order_relaxed);
+  }
+}
+
+} // namespace socket
+} // namespace rdmapp
@@ -1,14 +1,20 @@
 #include "socket/event_loop.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cerrno>
+#include <cstring>
+#include <linux/io_uring.h>
 #include <memory>
 #include <mutex>
-#include <shared_mutex>
 #include <string>
 #include <strings.h>
 #include <sys/epoll.h>
+#include <poll.h>
 #include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <thread>
 #include <unistd.h>
 #include <vector>
 
@@ -37,6 +43,12 @@ static inline std::string events_string(int events) {
   if (events & EPOLLHUP) {
     parts.emplace_back("EPOLLHUP");
   }
+  if (events & EPOLLRDHUP) {
+    parts.emplace_back("EPOLLRDHUP");
+  }
+  if (events & EPOLLET) {
+    parts.emplace_back("EPOLLET");
+  }
   auto str = std::string();
   bool first = true;
   for (auto &&part : parts) {
@@ -48,71 +60,137 @@ static inline std::string events_string(int events) {
   return str;
 }
 
-event_loop::event_loop(size_t max_events)
-    : epoll_fd_(-1), close_event_fd_(-1), max_events_(max_events) {
-  epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
-  check_errno(epoll_fd_, "failed to create epoll fd");
+// The user data of an io_uring submission is either the address of an
+// io_request or a channel operation: the kind in the low 3 bits, then the fd,
+// then the generation of the channel in the high 32 bits.
+enum : uint64_t {
+  kRequest = 0,
+  kReadPoll = 1,
+  kWritePoll = 2,
+  kAccept = 3,
+  kClose = 4,
+  kIgnore = 5,
+};
+static constexpr uint64_t kKindMask = 7;
+
+static inline uint64_t user_data(int fd, uint32_t generation, uint64_t kind) {
+  return (static_cast<uint64_t>(generation) << 32) |
+         (static_cast<uint64_t>(static_cast<uint32_t>(fd)) << 3) | kind;
+}
+
+static_assert(alignof(io_request) > kKindMask);
+
+// The epoll data of a channel: its fd and the generation of its registration.
+static inline uint64_t epoll_data(int fd, uint32_t generation) {
+  return (static_cast<uint64_t>(generation) << 32) | static_cast<uint32_t>(fd);
+}
+
+event_loop::event_loop(size_t max_events, io_backend backend)
+    : backend_(backend), epoll_fd_(-1), close_event_fd_(-1),
+      max_events_(max_events), multishot_accept_(true) {
   close_event_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
   check_errno(close_event_fd_, "failed to create close event fd");
+  if (backend_ == io_backend::io_uring) {
+    setup_uring();
+    return;
+  }
+  epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+  check_errno(epoll_fd_, "failed to create epoll fd");
   struct epoll_event event;
   event.events = EPOLLIN | EPOLLERR;
-  event.data.fd = close_event_fd_;
+  event.data.u64 = epoll_data(close_event_fd_, 0);
   check_errno(::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, close_event_fd_, &event),
               "failed to add close event fd to epoll");
 }
 
-std::shared_ptr<event_loop> event_loop::new_loop(size_t max_events) {
-  return std::make_shared<event_loop>(max_events);
+std::shared_ptr<event_loop> event_loop::new_loop(size_t max_events,
+                                                 io_backend backend) {
+  return std::make_shared<event_loop>(max_events, backend);
 }
 
-void event_loop::register_channel(std::shared_ptr<channel> channel,
-                                  struct epoll_event *event) {
+io_backend event_loop::backend() const { return backend_; }
+
+void event_loop::register_channel(std::shared_ptr<channel> channel) {
   assert(epoll_fd_ > 0);
-  RDMAPP_LOG_TRACE("epoll add fd=%d events=%s", channel->fd(),
-                   events_string(event->events).c_str());
-  {
-    std::lock_guard lock(mutex);
-    channels_.insert(std::make_pair(channel->fd(), channel));
+  if (channel->registered_.exchange(true)) {
+    return;
   }
-  auto rc = ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, channel->fd(), event);
+  // Register both directions once, edge-triggered. The channel caches the
+  // readiness it is told about, so waiting does not touch the epoll set.
+  channel->generation_ = channels_.insert(channel->fd(), channel);
+  struct epoll_event event;
+  event.data.u64 = epoll_data(channel->fd(), channel->generation_);
+  event.events = EPOLLIN | EPOLLPRI | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  RDMAPP_LOG_TRACE("epoll add fd=%d events=%s", channel->fd(),
+                   events_string(event.events).c_str());
+  auto rc = ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, channel->fd(), &event);
   try {
     check_errno(rc, "failed to add fd to epoll");
   } catch (...) {
-    std::lock_guard lock(mutex);
-    channels_.erase(channel->fd());
+    channel->registered_ = false;
+    channels_.erase(channel->fd(), channel->generation_);
     throw;
   }
 }
 
 void event_loop::register_read(std::shared_ptr<channel> channel) {
-  struct epoll_event event;
-  event.data.fd = channel->fd();
-  event.events = EPOLLIN | EPOLLPRI;
-  register_channel(channel, &event);
+  if (backend_ == io_backend::io_uring) {
+    submit_poll(channel, false);
+    return;
+  }
+  register_channel(channel);
 }
 
 void event_loop::register_write(std::shared_ptr<channel> channel) {
-  struct epoll_event event;
-  event.data.fd = channel->fd();
-  event.events = EPOLLOUT;
-  register_channel(channel, &event);
+  if (backend_ == io_backend::io_uring) {
+    submit_poll(channel, true);
+    return;
+  }
+  register_channel(channel);
 }
 
 void event_loop::deregister(socket::channel &channel) {
+  if (backend_ == io_backend::io_uring) {
+    std::lock_guard sq_lock(sq_mutex_);
+    if (channel.generation_ == 0) {
+      return;
+    }
+    channels_.erase(channel.fd(), channel.generation_);
+    // Cancel by user data rather than by fd: the fd is about to be closed and
+    // may be reused before the cancellation is issued.
+    for (auto kind : {kReadPoll, kWritePoll, kAccept}) {
+      auto sqe = get_sqe();
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->fd = -1;
+      sqe->addr = user_data(channel.fd(), channel.generation_, kind);
+      sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+      sqe->user_data = kIgnore;
+    }
+    submit_if_remote();
+    return;
+  }
   assert(epoll_fd_ > 0);
+  if (!channel.registered_.exchange(false)) {
+    return;
+  }
   struct epoll_event event;
   ::bzero(&event, sizeof(event));
   auto rc = ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, channel.fd(), &event);
   if (rc < 0 && errno != ENOENT) {
     check_errno(rc, "failed to remove fd from epoll");
   }
-  {
-    std::lock_guard lock(mutex);
-    channels_.erase(channel.fd());
-  }
+  channels_.erase(channel.fd(), channel.generation_);
 }
 
 void event_loop::loop() {
+  if (backend_ == io_backend::io_uring) {
+    uring_loop();
+  } else {
+    epoll_loop();
+  }
+}
+
+void event_loop::epoll_loop() {
   std::vector<struct epoll_event> events(max_events_);
   bool close_triggered = false;
   while (!close_triggered) {
@@ -123,40 +201,270 @@ void event_loop::loop() {
     check_errno(nr_events, "failed to epoll wait");
     for (int i = 0; i < nr_events; ++i) {
       auto &event = events[i];
-      auto fd = event.data.fd;
+      auto fd = static_cast<int>(event.data.u64 & 0xffffffff);
       RDMAPP_LOG_TRACE("fd: %d events: %s", fd,
                        events_string(event.events).c_str());
-      if (event.data.fd == close_event_fd_) {
+      if (event.data.u64 == epoll_data(close_event_fd_, 0)) {
         close_triggered = true;
         continue;
       }
-      auto channel = [&]() {
-        std::shared_lock lock(mutex);
-        auto it = channels_.find(fd);
-        assert(it != channels_.end());
-        return it->second.lock();
-      }();
+      auto channel =
+          channels_.find(fd, static_cast<uint32_t>(event.data.u64 >> 32));
+      if (!channel) {
+        continue;
+      }
+      // Errors and hang-ups wake both directions, the I/O reports them.
+      auto failed = event.events & (EPOLLERR | EPOLLHUP);
+      if (event.events & (EPOLLIN | EPOLLPRI | EPOLLRDHUP) || failed) {
+        channel->readable_callback();
+      }
+      if (event.events & EPOLLOUT || failed) {
+        channel->writable_callback();
+      }
+    }
+  }
+}
+
+void event_loop::setup_uring() {
+  ring_ = std::make_unique<uring>(kRingEntries);
+  auto sqe = get_sqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = close_event_fd_;
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = kClose;
+  // Stage small transfers through registered buffers, so the kernel does not
+  // have to pin the pages of every request. The registration counts against
+  // RLIMIT_MEMLOCK, so carry on without them if it fails.
+  fixed_buffers_ = std::make_unique<char[]>(kFixedBufferSize * kFixedBuffers);
+  std::vector<struct iovec> iovecs(kFixedBuffers);
+  for (size_t i = 0; i < kFixedBuffers; ++i) {
+    iovecs[i].iov_base = &fixed_buffers_[i * kFixedBufferSize];
+    iovecs[i].iov_len = kFixedBufferSize;
+  }
+  if (ring_->register_buffers(iovecs.data(), iovecs.size()) == 0) {
+    for (int i = kFixedBuffers - 1; i >= 0; --i) {
+      free_fixed_.push_back(i);
+    }
+  } else {
+    RDMAPP_LOG_ERROR("failed to register io_uring buffers: %s (errno=%d)",
+                     strerror(errno), errno);
+    fixed_buffers_.reset();
+  }
+}
+
+struct io_uring_sqe *event_loop::get_sqe(unsigned reserve) {
+  // Linked entries must be submitted together, so flush before running out.
+  while (ring_->space_left() < reserve) {
+    auto rc = ring_->enter(ring_->flush(), 0);
+    if (rc < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      check_errno(rc, "failed to submit to io_uring");
+    }
+  }
+  return ring_->get_sqe();
+}
+
+void event_loop::submit_if_remote() {
+  // The loop thread submits everything it queued in one go when it next waits.
+  // Any other thread submits right away: the completion wakes the loop.
+  auto to_submit = ring_->flush();
+  if (to_submit > 0 && std::this_thread::get_id() != loop_thread_.load()) {
+    auto rc = ring_->enter(to_submit, 0);
+    if (rc < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      check_errno(rc, "failed to submit to io_uring");
+    }
+  }
+}
+
+uint64_t event_loop::track_channel(std::shared_ptr<channel> channel) {
+  if (channel->generation_ == 0) {
+    channel->generation_ = channels_.insert(channel->fd(), channel);
+  }
+  return user_data(channel->fd(), channel->generation_, 0);
+}
+
+void event_loop::submit_poll(std::shared_ptr<channel> channel, bool write) {
+  std::lock_guard sq_lock(sq_mutex_);
+  auto data = track_channel(channel);
+  auto sqe = get_sqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = channel->fd();
+  sqe->poll32_events = write ? POLLOUT : POLLIN | POLLPRI;
+  sqe->user_data = data | (write ? kWritePoll : kReadPoll);
+  RDMAPP_LOG_TRACE("io_uring poll fd=%d %s", channel->fd(),
+                   write ? "POLLOUT" : "POLLIN");
+  submit_if_remote();
+}
+
+void event_loop::submit_accept(std::shared_ptr<channel> channel) {
+  assert(backend_ == io_backend::io_uring);
+  std::lock_guard sq_lock(sq_mutex_);
+  auto data = track_channel(channel);
+  auto sqe = get_sqe();
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = channel->fd();
+  sqe->accept_flags = SOCK_CLOEXEC | SOCK_NONBLOCK;
+  if (multishot_accept_.load(std::memory_order_relaxed)) {
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  }
+  sqe->user_data = data | kAccept;
+  submit_if_remote();
+}
+
+// Copy between a request's buffers and the registered buffer staging them:
+// gather into it before a write, scatter out of it after a read.
+static void copy_fixed(io_request &request, char *fixed, size_t length) {
+  if (request.iov == nullptr) {
+    if (request.write) {
+      std::memcpy(fixed, request.buffer, length);
+    } else {
+      std::memcpy(request.buffer, fixed, length);
+    }
+    return;
+  }
+  for (int i = 0; i < request.iovcnt && length > 0; ++i) {
+    auto n = std::min(length, request.iov[i].iov_len);
+    if (request.write) {
+      std::memcpy(fixed, request.iov[i].iov_base, n);
+    } else {
+      std::memcpy(request.iov[i].iov_base, fixed, n);
+    }
+    fixed += n;
+    length -= n;
+  }
+}
+
+void event_loop::issue(io_request &request, bool after_poll) {
+  if (after_poll) {
+    // The socket was not ready: retry once it is, without an extra completion.
+    auto sqe = get_sqe(2);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = request.fd;
+    sqe->poll32_events = request.write ? POLLOUT : POLLIN;
+    sqe->flags = IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = kIgnore;
+  }
+  auto sqe = get_sqe();
+  sqe->fd = request.fd;
+  if (request.fixed_index >= 0) {
+    sqe->opcode = request.write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    sqe->addr = reinterpret_cast<uint64_t>(
+        &fixed_buffers_[request.fixed_index * kFixedBufferSize]);
+    sqe->buf_index = request.fixed_index;
+    sqe->len = request.length;
+  } else if (request.iov != nullptr) {
+    sqe->opcode = request.write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->addr = reinterpret_cast<uint64_t>(request.iov);
+    sqe->len = request.iovcnt;
+  } else {
+    sqe->opcode = request.write ? IORING_OP_SEND : IORING_OP_RECV;
+    sqe->addr = reinterpret_cast<uint64_t>(request.buffer);
+    sqe->msg_flags = request.write ? MSG_NOSIGNAL : 0;
+    sqe->len = request.length;
+  }
+  sqe->user_data = reinterpret_cast<uint64_t>(&request) | kRequest;
+}
+
+void event_loop::submit_io(io_request &request) {
+  assert(backend_ == io_backend::io_uring);
+  std::lock_guard sq_lock(sq_mutex_);
+  if (request.length <= kFixedBufferSize && !free_fixed_.empty()) {
+    request.fixed_index = free_fixed_.back();
+    free_fixed_.pop_back();
+    if (request.write) {
+      copy_fixed(request,
+                 &fixed_buffers_[request.fixed_index * kFixedBufferSize],
+                 request.length);
+    }
+  }
+  issue(request, false);
+  submit_if_remote();
+}
+
+void event_loop::complete_request(io_request &request, int res) {
+  if (res == -EAGAIN) {
+    std::lock_guard sq_lock(sq_mutex_);
+    issue(request, true);
+    return;
+  }
+  if (request.fixed_index >= 0) {
+    if (!request.write && res > 0) {
+      copy_fixed(request,
+                 &fixed_buffers_[request.fixed_index * kFixedBufferSize],
+                 res);
+    }
+    std::lock_guard sq_lock(sq_mutex_);
+    free_fixed_.push_back(request.fixed_index);
+    request.fixed_index = -1;
+  }
+  request.complete(&request, res);
+}
+
+bool event_loop::handle_cqe(const struct io_uring_cqe &cqe) {
+  auto kind = cqe.user_data & kKindMask;
+  if (kind == kRequest) {
+    complete_request(*reinterpret_cast<io_request *>(cqe.user_data), cqe.res);
+    return false;
+  }
+  if (kind == kClose) {
+    return true;
+  }
+  if (kind == kIgnore) {
+    return false;
+  }
+  int fd = static_cast<int>((cqe.user_data & 0xffffffff) >> 3);
+  auto generation = static_cast<uint32_t>(cqe.user_data >> 32);
+  auto channel = channels_.find(fd, generation);
+  RDMAPP_LOG_TRACE("io_uring fd: %d kind: %d res: %d", fd,
+                   static_cast<int>(kind), cqe.res);
+  if (kind == kAccept) {
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+    if (cqe.res == -EINVAL && !more &&
+        multishot_accept_.exchange(false, std::memory_order_relaxed)) {
+      // Multishot accept needs Linux 5.19: fall back to one accept per wait.
+      RDMAPP_LOG_DEBUG("multishot accept not supported, falling back");
       if (channel) {
-        if (event.events & EPOLLIN || event.events & EPOLLERR) {
-          channel->readable_callback();
-          if (event.events & EPOLLERR) {
-            std::lock_guard lock(mutex);
-            channels_.erase(fd);
-          }
-        }
-        if (event.events & EPOLLOUT || event.events & EPOLLERR) {
-          channel->writable_callback();
-          if (event.events & EPOLLERR) {
-            std::lock_guard lock(mutex);
-            channels_.erase(fd);
-          }
-        }
-      } else {
-        std::lock_guard lock(mutex);
-        channels_.erase(fd);
+        submit_accept(channel);
       }
+      return false;
+    }
+    if (channel) {
+      channel->accepted(cqe.res, more);
+    } else if (cqe.res >= 0) {
+      ::close(cqe.res);
+    }
+    return false;
+  }
+  if (!channel || cqe.res == -ECANCELED) {
+    return false;
+  }
+  if (kind == kReadPoll) {
+    channel->readable_callback();
+  } else {
+    channel->writable_callback();
+  }
+  return false;
+}
+
+void event_loop::uring_loop() {
+  loop_thread_ = std::this_thread::get_id();
+  bool close_triggered = false;
+  while (!close_triggered) {
+    unsigned to_submit;
+    {
+      std::lock_guard sq_lock(sq_mutex_);
+      to_submit = ring_->flush();
+    }
+    auto rc = ring_->enter(to_submit, 1);
+    if (rc < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY))
+        [[unlikely]] {
+      continue;
     }
+    check_errno(rc, "failed to wait on io_uring");
+    ring_->for_each_cqe([&](const struct io_uring_cqe &cqe) {
+      close_triggered |= handle_cqe(cqe);
+    });
   }
+  loop_thread_ = std::thread::id();
 }
 
 void event_loop::close() {
@@ -69,10 +69,10 @@ tcp_connection::connect_awaitable::connect_awaitable(
 
 bool tcp_connection::connect_awaitable::await_ready() { return rc_ == 0; }
 
-void tcp_connection::connect_awaitable::await_suspend(
+bool tcp_connection::connect_awaitable::await_suspend(
     std::coroutine_handle<> h) {
   channel_->set_writable_callback([h]() { h.resume(); });
-  channel_->wait_writable();
+  return channel_->wait_writable();
 }
 
 std::shared_ptr<tcp_connection>
@@ -95,15 +95,38 @@ tcp_connection::rw_awaitable tcp_connection::send(const void *buffer,
   return rw_awaitable(channel_, true, const_cast<void *>(buffer), length);
 }
 
+tcp_connection::rw_awaitable tcp_connection::readv(const struct iovec *iov,
+                                                   int iovcnt) {
+  return rw_awaitable(channel_, false, iov, iovcnt);
+}
+
+tcp_connection::rw_awaitable tcp_connection::writev(const struct iovec *iov,
+                                                    int iovcnt) {
+  return rw_awaitable(channel_, true, iov, iovcnt);
+}
+
 tcp_connection::rw_awaitable::rw_awaitable(std::shared_ptr<channel> channel,
                                            bool write, void *buffer,
                                            size_t length)
-    : channel_(channel), buffer_(buffer), n_(-1), length_(length),
-      write_(write) {}
+    : channel_(channel), buffer_(buffer), iov_(nullptr), iovcnt_(0), n_(-1),
+      length_(length), write_(write), error_(0) {}
+
+tcp_connection::rw_awaitable::rw_awaitable(std::shared_ptr<channel> channel,
+                                           bool write, const struct iovec *iov,
+                                           int iovcnt)
+    : channel_(channel), buffer_(nullptr), iov_(iov), iovcnt_(iovcnt), n_(-1),
+      length_(0), write_(write), error_(0) {
+  for (int i = 0; i < iovcnt; ++i) {
+    length_ += iov[i].iov_len;
+  }
+}
 
 int tcp_connection::rw_awaitable::do_io() {
   int n = -1;
-  if (write_) {
+  if (iov_ != nullptr) {
+    n = write_ ? ::writev(channel_->fd(), iov_, iovcnt_)
+               : ::readv(channel_->fd(), iov_, iovcnt_);
+  } else if (write_) {
     n = ::write(channel_->fd(), buffer_, length_);
   } else {
     n = ::read(channel_->fd(), buffer_, length_);
@@ -111,34 +134,89 @@ int tcp_connection::rw_awaitable::do_io() {
   return n;
 }
 
+bool tcp_connection::rw_awaitable::uses_io_uring() {
+  return channel_->loop()->backend() == io_backend::io_uring;
+}
+
+void tcp_connection::rw_awaitable::resume(io_request *self, int res) {
+  auto awaitable = static_cast<rw_awaitable *>(self);
+  awaitable->n_ = res;
+  awaitable->h_.resume();
+}
+
+bool tcp_connection::rw_awaitable::try_io() {
+  while (true) {
+    n_ = do_io();
+    if (n_ >= 0) {
+      return true;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      error_ = errno;
+      return true;
+    }
+    if (write_ ? channel_->wait_writable() : channel_->wait_readable()) {
+      return false;
+    }
+  }
+}
+
 bool tcp_connection::rw_awaitable::await_ready() {
+  if (uses_io_uring()) {
+    // Skip the speculative syscall, the request goes into the next batch.
+    return false;
+  }
   n_ = do_io();
   if (n_ >= 0) {
     return true;
   }
-  if (errno == EAGAIN || errno == EWOULDBLOCK) {
-    return false;
-  } else {
-    check_errno(n_, "failed to read write");
+  if (errno != EAGAIN && errno != EWOULDBLOCK) {
+    error_ = errno;
+    return true;
   }
   return false;
 }
 
-void tcp_connection::rw_awaitable::await_suspend(std::coroutine_handle<> h) {
-  auto &&callback = [h]() { h.resume(); };
+bool tcp_connection::rw_awaitable::await_suspend(std::coroutine_handle<> h) {
+  h_ = h;
+  if (uses_io_uring()) {
+    complete = &rw_awaitable::resume;
+    fd = channel_->fd();
+    write = write_;
+    buffer = buffer_;
+    length = length_;
+    iov = iov_;
+    iovcnt = iovcnt_;
+    channel_->loop()->submit_io(*this);
+    return true;
+  }
+  // Resume only once the I/O is done: a readiness report that turns out to be
+  // stale just parks the awaitable again.
+  auto &&callback = [this]() {
+    if (try_io()) {
+      h_.resume();
+    }
+  };
   if (write_) {
     channel_->set_writable_callback(callback);
-    channel_->wait_writable();
+    if (channel_->wait_writable()) {
+      return true;
+    }
   } else {
     channel_->set_readable_callback(callback);
-    channel_->wait_readable();
+    if (channel_->wait_readable()) {
+      return true;
+    }
   }
+  return !try_io();
 }
 
 int tcp_connection::rw_awaitable::await_resume() {
+  if (uses_io_uring() && n_ < 0) {
+    error_ = -n_;
+  }
   if (n_ < 0) {
-    n_ = do_io();
-    check_errno(n_, "failed to io after readable or writable");
+    errno = error_;
+    check_errno(n_, "failed to read write");
   }
   return n_;
 }
@@ -50,11 +50,8 @@ int tcp_listener::accept_awaitable::do_io() {
                             reinterpret_cast<struct sockaddr *>(&client_addr),
                             &client_addr_len, SOCK_CLOEXEC | SOCK_NONBLOCK);
   if (client_fd < 0) {
-    if (errno == EAGAIN || errno == EWOULDBLOCK) {
-      return client_fd;
-    }
+    return client_fd;
   }
-  check_errno(client_fd, "failed to accept");
   auto const &client_ip = get_in_addr_string(&client_addr);
   RDMAPP_LOG_DEBUG(
       "accepted connection from %s:%d fd=%d", client_ip.c_str(),
@@ -65,30 +62,77 @@ int tcp_listener::accept_awaitable::do_io() {
 
 tcp_listener::accept_awaitable::accept_awaitable(
     std::shared_ptr<channel> channel)
-    : channel_(channel), client_fd_(-1) {}
+    : channel_(channel), client_fd_(-1), popped_(false), error_(0) {}
+
+bool tcp_listener::accept_awaitable::try_accept() {
+  while (true) {
+    client_fd_ = do_io();
+    if (client_fd_ >= 0) {
+      return true;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      error_ = errno;
+      return true;
+    }
+    if (channel_->wait_readable()) {
+      return false;
+    }
+  }
+}
 
 bool tcp_listener::accept_awaitable::await_ready() {
+  if (channel_->loop()->backend() == io_backend::io_uring) {
+    popped_ = channel_->pop_accepted(client_fd_);
+    return popped_;
+  }
   client_fd_ = do_io();
-  return client_fd_ > 0;
+  if (client_fd_ < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+    error_ = errno;
+    return true;
+  }
+  return client_fd_ >= 0;
 }
 
-void tcp_listener::accept_awaitable::await_suspend(std::coroutine_handle<> h) {
-  channel_->set_readable_callback([h]() { h.resume(); });
-  channel_->wait_readable();
+bool tcp_listener::accept_awaitable::await_suspend(std::coroutine_handle<> h) {
+  if (channel_->loop()->backend() == io_backend::io_uring) {
+    // A multishot accept stays armed across connections, so a burst of
+    // connections costs a single submission.
+    return channel_->wait_accepted(h);
+  }
+  h_ = h;
+  channel_->set_readable_callback([this]() {
+    if (try_accept()) {
+      h_.resume();
+    }
+  });
+  if (channel_->wait_readable()) {
+    return true;
+  }
+  return !try_accept();
 }
 
 std::shared_ptr<channel> tcp_listener::accept_awaitable::await_resume() {
-  if (client_fd_ < 0) {
-    client_fd_ = do_io();
+  if (channel_->loop()->backend() == io_backend::io_uring) {
+    if (!popped_ && !channel_->pop_accepted(client_fd_)) {
+      client_fd_ = -EAGAIN;
+    }
+    if (client_fd_ < 0) {
+      errno = -client_fd_;
+      check_errno(-1, "failed to accept");
+    }
+    RDMAPP_LOG_DEBUG("accepted connection fd=%d", client_fd_);
+  } else if (client_fd_ < 0) {
+    errno = error_;
+    check_errno(client_fd_, "failed to accept");
   }
-  check_errno(client_fd_, "could not accept after readable");
   auto channel_ptr = std::make_shared<channel>(client_fd_, channel_->loop());
   channel_ptr->set_nonblocking();
   return channel_ptr;
 }
 
 tcp_listener::tcp_listener(std::shared_ptr<event_loop> loop,
-                           std::string const &hostname, uint16_t port) {
+                           std::string const &hostname, uint16_t port,
+                           bool reuse_port) {
   std::string port_str = std::to_string(port);
   int fd = ::socket(AF_INET, SOCK_STREAM, 0);
 
@@ -97,6 +141,10 @@ tcp_listener::tcp_listener(std::shared_ptr<event_loop> loop,
     int32_t yes = 1;
     check_rc(::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)),
              "failed to set reuse address");
+    if (reuse_port) {
+      check_rc(::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)),
+               "failed to set reuse port");
+    }
   }
 
   struct addrinfo hints, *servinfo, *p;
@@ -124,7 +172,7 @@ tcp_listener::tcp_listener(std::shared_ptr<event_loop> loop,
   }
   ::freeaddrinfo(servinfo);
   check_ptr(p, "failed to bind");
-  check_errno(::listen(fd, 128), "failed to listen");
+  check_errno(::listen(fd, SOMAXCONN), "failed to listen");
   channel_ = std::make_shared<channel>(fd, loop);
   channel_->set_nonblocking();
   RDMAPP_LOG_DEBUG("acceptor fd %d listening on %d", fd, port);
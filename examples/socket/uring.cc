@@ -0,0 +1,133 @@
+#include "socket/uring.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <rdmapp/detail/debug.h>
+#include <rdmapp/error.h>
+
+namespace rdmapp {
+namespace socket {
+
+template <class T> static inline T *ring_ptr(void *ring, uint32_t offset) {
+  return reinterpret_cast<T *>(static_cast<char *>(ring) + offset);
+}
+
+uring::uring(unsigned entries)
+    : fd_(-1), sqe_tail_(0), sq_ring_(MAP_FAILED), cq_ring_(MAP_FAILED) {
+  struct io_uring_params params;
+  ::bzero(&params, sizeof(params));
+  params.flags = IORING_SETUP_CLAMP;
+  fd_ = ::syscall(__NR_io_uring_setup, entries, &params);
+  check_errno(fd_, "failed to setup io_uring");
+  sq_entries_ = params.sq_entries;
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+  }
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  try {
+    sq_ring_ = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) {
+      check_errno(-1, "failed to map io_uring submission ring");
+    }
+    if (single_mmap) {
+      cq_ring_ = sq_ring_;
+    } else {
+      cq_ring_ = ::mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+      if (cq_ring_ == MAP_FAILED) {
+        check_errno(-1, "failed to map io_uring completion ring");
+      }
+    }
+    auto sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+      check_errno(-1, "failed to map io_uring submission entries");
+    }
+    sqes_ = static_cast<struct io_uring_sqe *>(sqes);
+  } catch (...) {
+    if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+      ::munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_ != MAP_FAILED) {
+      ::munmap(sq_ring_, sq_ring_size_);
+    }
+    ::close(fd_);
+    throw;
+  }
+  sq_head_ = ring_ptr<unsigned>(sq_ring_, params.sq_off.head);
+  sq_tail_ = ring_ptr<unsigned>(sq_ring_, params.sq_off.tail);
+  sq_mask_ = ring_ptr<unsigned>(sq_ring_, params.sq_off.ring_mask);
+  sq_array_ = ring_ptr<unsigned>(sq_ring_, params.sq_off.array);
+  cq_head_ = ring_ptr<unsigned>(cq_ring_, params.cq_off.head);
+  cq_tail_ = ring_ptr<unsigned>(cq_ring_, params.cq_off.tail);
+  cq_mask_ = ring_ptr<unsigned>(cq_ring_, params.cq_off.ring_mask);
+  cqes_ = ring_ptr<struct io_uring_cqe>(cq_ring_, params.cq_off.cqes);
+  sqe_tail_ = *sq_tail_;
+  RDMAPP_LOG_TRACE("created io_uring fd=%d sq_entries=%u cq_entries=%u", fd_,
+                   params.sq_entries, params.cq_entries);
+}
+
+int uring::fd() const { return fd_; }
+
+unsigned uring::space_left() const {
+  auto head = std::atomic_ref(*sq_head_).load(std::memory_order_acquire);
+  return sq_entries_ - (sqe_tail_ - head);
+}
+
+struct io_uring_sqe *uring::get_sqe() {
+  if (space_left() == 0) {
+    return nullptr;
+  }
+  auto index = sqe_tail_ & *sq_mask_;
+  auto sqe = &sqes_[index];
+  ::bzero(sqe, sizeof(*sqe));
+  sq_array_[index] = index;
+  ++sqe_tail_;
+  return sqe;
+}
+
+unsigned uring::flush() {
+  std::atomic_ref(*sq_tail_).store(sqe_tail_, std::memory_order_release);
+  return sqe_tail_ - std::atomic_ref(*sq_head_).load(std::memory_order_acquire);
+}
+
+int uring::enter(unsigned to_submit, unsigned min_complete) {
+  unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+  return ::syscall(__NR_io_uring_enter, fd_, to_submit, min_complete, flags,
+                   nullptr, 0);
+}
+
+int uring::register_buffers(const struct iovec *iovecs, unsigned nr_iovecs) {
+  return ::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS,
+                   iovecs, nr_iovecs);
+}
+
+uring::~uring() {
+  ::munmap(sqes_, sqes_size_);
+  if (cq_ring_ != sq_ring_) {
+    ::munmap(cq_ring_, cq_ring_size_);
+  }
+  ::munmap(sq_ring_, sq_ring_size_);
+  if (auto rc = ::close(fd_); rc != 0) {
+    RDMAPP_LOG_ERROR("failed to close io_uring fd %d: %s (errno=%d)", fd_,
+                     strerror(errno), errno);
+  } else {
+    RDMAPP_LOG_TRACE("closed io_uring fd %d", fd_);
+  }
+}
+
+} // namespace socket
+} // namespace rdmapp
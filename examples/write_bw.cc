@@ -19,6 +19,21 @@ std::atomic<size_t> gSendCount = 0;
 
 constexpr size_t kBufferSizeBytes = 8;
 constexpr size_t kSendCount = 1024 * 1024 * 1024;
+constexpr size_t kWindowSize = 16; // The number of writes kept in flight.
+
+rdmapp::lazy_task<void> windowed_write(std::shared_ptr<rdmapp::queue_pair> qp, rdmapp::remote_mr remote_mr,
+                                       std::shared_ptr<rdmapp::local_mr> local_mr, rdmapp::async_semaphore& window)
+{
+   try {
+      co_await qp->write(remote_mr, local_mr);
+   }
+   catch (...) {
+      window.release();
+      throw;
+   }
+   gSendCount.fetch_add(1);
+   window.release();
+}
 
 rdmapp::task<void> client_worker(std::shared_ptr<rdmapp::queue_pair> qp)
 {
@@ -30,10 +45,13 @@ rdmapp::task<void> client_worker(std::shared_ptr<rdmapp::queue_pair> qp)
    auto remote_mr = rdmapp::remote_mr::deserialize(remote_mr_serialized);
    std::cout << "Received mr addr=" << remote_mr.addr << " length=" << remote_mr.length << " rkey=" << remote_mr.rkey
              << " from server" << std::endl;
+   rdmapp::async_semaphore window(kWindowSize);
+   rdmapp::async_scope writes;
    for (size_t i = 0; i < kSendCount; ++i) {
-      co_await qp->write(remote_mr, local_mr);
-      gSendCount.fetch_add(1);
+      co_await window.acquire();
+      writes.spawn(windowed_write(qp, remote_mr, local_mr, window));
    }
+   co_await writes.join();
    co_await qp->write_with_imm(remote_mr, local_mr, 0xDEADBEEF);
    co_return;
 }
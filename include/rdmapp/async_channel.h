@@ -0,0 +1,242 @@
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+#include "rdmapp/detail/util.h"
+#include "rdmapp/detail/waiter_queue.h"
+#include "rdmapp/error.h"
+#include "rdmapp/executor.h"
+
+namespace rdmapp
+{
+   /**
+    * @brief A bounded multi-producer multi-consumer channel between coroutines, such as to hand buffers from the
+    * coroutines completing receives to those processing them. send() suspends while the channel is full and recv()
+    * while it is empty, without blocking their threads. A channel with a capacity of zero hands each value from a
+    * sender straight to a receiver.
+    *
+    * Senders and receivers are served in FIFO order. A coroutine woken by the other side is resumed on the executor if
+    * one is given, and on the thread of the other side otherwise.
+    *
+    * @tparam T The type of the values. It must be move constructible.
+    */
+   template <class T>
+   class async_channel : public noncopyable
+   {
+      struct send_awaiter;
+      struct recv_awaiter;
+
+      std::mutex mutex_;
+      const size_t capacity_;
+      std::deque<T> buffer_;
+      detail::waiter_queue senders_; // Waiting for space while the buffer is full.
+      detail::waiter_queue receivers_; // Waiting for a value while the buffer is empty.
+      bool closed_{};
+      std::shared_ptr<executor> exec_;
+
+      void resume(detail::async_waiter* waiter) { detail::resume_waiter(exec_.get(), waiter->h_); }
+
+      // Called with the lock held. Returns whether the value was taken, and sets woken to the receiver it went to.
+      bool offer(T& value, detail::async_waiter*& woken)
+      {
+         if (auto waiter = receivers_.pop_front()) {
+            static_cast<recv_awaiter*>(waiter)->value_.emplace(std::move(value));
+            woken = waiter;
+            return true;
+         }
+         if (buffer_.size() < capacity_) {
+            buffer_.push_back(std::move(value));
+            return true;
+         }
+         return false;
+      }
+
+      // Called with the lock held. Returns the next value, if any, and sets woken to the sender that made room.
+      std::optional<T> take(detail::async_waiter*& woken)
+      {
+         if (!buffer_.empty()) {
+            std::optional<T> value(std::move(buffer_.front()));
+            buffer_.pop_front();
+            if (auto waiter = senders_.pop_front()) {
+               buffer_.push_back(std::move(static_cast<send_awaiter*>(waiter)->value_));
+               woken = waiter;
+            }
+            return value;
+         }
+         if (auto waiter = senders_.pop_front()) {
+            woken = waiter;
+            return std::optional<T>(std::move(static_cast<send_awaiter*>(waiter)->value_));
+         }
+         return std::nullopt;
+      }
+
+      struct send_awaiter : public detail::async_waiter
+      {
+         async_channel& channel_;
+         T value_;
+         bool closed_{};
+
+         bool await_ready() const noexcept { return false; }
+
+         bool await_suspend(std::coroutine_handle<> h)
+         {
+            detail::async_waiter* woken = nullptr;
+            {
+               std::lock_guard lock(channel_.mutex_);
+               if (channel_.closed_) {
+                  closed_ = true;
+                  return false;
+               }
+               if (!channel_.offer(value_, woken)) {
+                  h_ = h;
+                  channel_.senders_.push_back(*this);
+                  return true;
+               }
+            }
+            if (woken != nullptr) {
+               channel_.resume(woken);
+            }
+            return false;
+         }
+
+         void await_resume() const
+         {
+            if (closed_) [[unlikely]] {
+               throw channel_closed_error("send on a closed channel");
+            }
+         }
+      };
+
+      struct recv_awaiter : public detail::async_waiter
+      {
+         async_channel& channel_;
+         std::optional<T> value_;
+
+         bool await_ready() const noexcept { return false; }
+
+         bool await_suspend(std::coroutine_handle<> h)
+         {
+            detail::async_waiter* woken = nullptr;
+            {
+               std::lock_guard lock(channel_.mutex_);
+               value_ = channel_.take(woken);
+               if (!value_ && !channel_.closed_) {
+                  h_ = h;
+                  channel_.receivers_.push_back(*this);
+                  return true;
+               }
+            }
+            if (woken != nullptr) {
+               channel_.resume(woken);
+            }
+            return false;
+         }
+
+         std::optional<T> await_resume() { return std::move(value_); }
+      };
+
+     public:
+      /**
+       * @brief Construct a new channel.
+       *
+       * @param capacity The number of values buffered before send() suspends.
+       * @param exec (Optional) The executor to resume woken coroutines on.
+       */
+      explicit async_channel(size_t capacity, std::shared_ptr<executor> exec = nullptr)
+         : capacity_(capacity), exec_(std::move(exec))
+      {}
+
+      /**
+       * @brief Send a value, waiting for space if the channel is full.
+       *
+       * @param value The value.
+       * @return auto An awaitable that returns once the value is buffered or received. It throws channel_closed_error
+       * if the channel is closed, before or while waiting, and the value is then dropped.
+       */
+      [[nodiscard]] auto send(T value) { return send_awaiter{{}, *this, std::move(value)}; }
+
+      /**
+       * @brief Receive a value, waiting for one if the channel is empty.
+       *
+       * @return auto An awaitable that returns the value, or std::nullopt once the channel is closed and drained.
+       */
+      [[nodiscard]] auto recv() { return recv_awaiter{{}, *this, std::nullopt}; }
+
+      /**
+       * @brief Send a value if there is room for it, without waiting.
+       *
+       * @param value The value, moved from only if it was sent.
+       * @return true If the value was sent.
+       */
+      bool try_send(T& value)
+      {
+         detail::async_waiter* woken = nullptr;
+         {
+            std::lock_guard lock(mutex_);
+            if (closed_ || !offer(value, woken)) {
+               return false;
+            }
+         }
+         if (woken != nullptr) {
+            resume(woken);
+         }
+         return true;
+      }
+
+      /**
+       * @brief Receive a value if one is ready, without waiting.
+       *
+       * @return std::optional<T> The value, or std::nullopt if there is none.
+       */
+      std::optional<T> try_recv()
+      {
+         detail::async_waiter* woken = nullptr;
+         std::optional<T> value;
+         {
+            std::lock_guard lock(mutex_);
+            value = take(woken);
+         }
+         if (woken != nullptr) {
+            resume(woken);
+         }
+         return value;
+      }
+
+      /**
+       * @brief Close the channel. Waiting senders fail with channel_closed_error, and receivers get the values
+       * still buffered, then std::nullopt.
+       */
+      void close()
+      {
+         detail::async_waiter* senders;
+         detail::async_waiter* receivers;
+         {
+            std::lock_guard lock(mutex_);
+            if (closed_) {
+               return;
+            }
+            closed_ = true;
+            senders = senders_.take_all();
+            // Receivers only wait while the buffer is empty, so there is nothing left for them.
+            receivers = receivers_.take_all();
+         }
+         while (senders != nullptr) {
+            auto next = senders->next_;
+            static_cast<send_awaiter*>(senders)->closed_ = true;
+            resume(senders);
+            senders = next;
+         }
+         while (receivers != nullptr) {
+            auto next = receivers->next_;
+            resume(receivers);
+            receivers = next;
+         }
+      }
+   };
+} // namespace rdmapp
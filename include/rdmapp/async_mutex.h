@@ -0,0 +1,83 @@
+#pragma once
+
+#include <coroutine>
+#include <memory>
+#include <utility>
+
+#include "rdmapp/async_semaphore.h"
+#include "rdmapp/detail/util.h"
+#include "rdmapp/executor.h"
+
+namespace rdmapp
+{
+   class async_mutex;
+
+   // Owns a lock of an async_mutex and unlocks it when destroyed.
+   class async_lock_guard
+   {
+      async_mutex* mutex_;
+
+     public:
+      explicit async_lock_guard(async_mutex& mutex) : mutex_(&mutex) {}
+      async_lock_guard(async_lock_guard&& other) noexcept : mutex_(std::exchange(other.mutex_, nullptr)) {}
+      async_lock_guard(const async_lock_guard&) = delete;
+      async_lock_guard& operator=(const async_lock_guard&) = delete;
+      ~async_lock_guard();
+   };
+
+   /**
+    * @brief A mutex that suspends the awaiting coroutine instead of blocking its thread, so a critical section may
+    * itself await operations. The lock is not tied to a thread: it may be released on another thread than the one
+    * that took it. Waiters take the lock in FIFO order, on the executor if one is given and on the thread calling
+    * unlock() otherwise.
+    */
+   class async_mutex : public noncopyable
+   {
+      async_semaphore sem_;
+
+     public:
+      /**
+       * @brief Construct a new mutex.
+       *
+       * @param exec (Optional) The executor to resume waiters on.
+       */
+      explicit async_mutex(std::shared_ptr<executor> exec = nullptr) : sem_(1, std::move(exec)) {}
+
+      bool try_lock() { return sem_.try_acquire(); }
+
+      /**
+       * @brief Take the lock. Release it with unlock().
+       *
+       * @return auto An awaitable that returns once the lock is taken.
+       */
+      [[nodiscard]] auto lock() { return sem_.acquire(); }
+
+      /**
+       * @brief Take the lock for the scope of the returned guard.
+       *
+       * @return auto An awaitable that returns an async_lock_guard once the lock is taken.
+       */
+      [[nodiscard]] auto scoped_lock()
+      {
+         struct awaiter
+         {
+            async_mutex& mutex_;
+            decltype(std::declval<async_semaphore&>().acquire()) acquire_;
+
+            bool await_ready() { return acquire_.await_ready(); }
+            bool await_suspend(std::coroutine_handle<> h) { return acquire_.await_suspend(h); }
+            async_lock_guard await_resume() { return async_lock_guard(mutex_); }
+         };
+         return awaiter{*this, sem_.acquire()};
+      }
+
+      void unlock() { sem_.release(); }
+   };
+
+   inline async_lock_guard::~async_lock_guard()
+   {
+      if (mutex_ != nullptr) {
+         mutex_->unlock();
+      }
+   }
+} // namespace rdmapp
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "rdmapp/detail/frame_pool.h"
+#include "rdmapp/detail/util.h"
+#include "rdmapp/when_all.h"
+
+namespace rdmapp
+{
+   class async_scope;
+
+   namespace detail
+   {
+      // Runs one operation spawned in an async_scope. It starts right away and frees itself once the operation is done.
+      struct scope_task
+      {
+         struct promise_type : public pooled_frame
+         {
+            async_scope& scope_;
+
+            template <class A>
+            promise_type(async_scope& scope, A&) : scope_(scope)
+            {}
+
+            scope_task get_return_object() { return {}; }
+
+            std::suspend_never initial_suspend() noexcept { return {}; }
+
+            auto final_suspend() noexcept;
+
+            void return_void() {}
+
+            // The coroutine body catches everything.
+            void unhandled_exception() noexcept { std::terminate(); }
+         };
+      };
+   } // namespace detail
+
+   /**
+    * @brief Owns operations that run in the background, such as the handlers of the connections accepted by a server,
+    * in place of task::detach(). Their exceptions are kept rather than lost, and join() waits for all of them without
+    * blocking a thread.
+    *
+    * Operations may be spawned from any thread, and by the operations of the scope themselves, until join() is
+    * awaited. Once join() returns, the scope can be used again. It must be joined before it is destroyed.
+    */
+   class async_scope : public noncopyable
+   {
+      friend struct detail::scope_task::promise_type;
+
+      // The operations running, plus one for join().
+      std::atomic<size_t> count_{1};
+      std::coroutine_handle<> joiner_;
+      std::mutex mutex_;
+      std::vector<std::exception_ptr> exceptions_;
+
+      template <class A>
+      static detail::scope_task run(async_scope& scope, A awaitable)
+      {
+         try {
+            co_await awaitable;
+         }
+         catch (...) {
+            scope.fail(std::current_exception());
+         }
+      }
+
+      // Called by each operation as it completes. Returns the coroutine to transfer to.
+      std::coroutine_handle<> arrive() noexcept
+      {
+         return count_.fetch_sub(1, std::memory_order_acq_rel) == 1 ? joiner_ : std::noop_coroutine();
+      }
+
+      void fail(std::exception_ptr exception)
+      {
+         std::lock_guard lock(mutex_);
+         exceptions_.push_back(std::move(exception));
+      }
+
+     public:
+      async_scope() = default;
+
+      ~async_scope() { assert(count_.load(std::memory_order_acquire) == 1 && "async_scope destroyed before join()"); }
+
+      /**
+       * @brief Start an operation in the scope. It runs on the calling thread until it first suspends.
+       *
+       * @param awaitable The operation, such as a task, a lazy_task or an awaitable of queue_pair. It is moved into
+       * the scope.
+       */
+      template <detail::awaitable Awaitable>
+      void spawn(Awaitable awaitable)
+      {
+         count_.fetch_add(1, std::memory_order_relaxed);
+         run(*this, std::move(awaitable));
+      }
+
+      // The number of operations that have not completed.
+      size_t size() const { return count_.load(std::memory_order_acquire) - 1; }
+
+      /**
+       * @brief Take the exceptions of the operations that have failed so far.
+       *
+       * @return std::vector<std::exception_ptr> The exceptions, in the order the operations failed.
+       */
+      std::vector<std::exception_ptr> take_exceptions()
+      {
+         std::lock_guard lock(mutex_);
+         return std::exchange(exceptions_, {});
+      }
+
+      /**
+       * @brief Wait for every operation of the scope to complete. The awaiting coroutine is resumed by whichever
+       * completes last.
+       *
+       * @return auto An awaitable that rethrows the first exception not yet taken with take_exceptions(), if any, and
+       * drops the others.
+       */
+      auto join()
+      {
+         struct awaiter
+         {
+            async_scope& scope_;
+
+            bool await_ready() const noexcept { return scope_.size() == 0; }
+
+            bool await_suspend(std::coroutine_handle<> h) noexcept
+            {
+               scope_.joiner_ = h;
+               return scope_.count_.fetch_sub(1, std::memory_order_acq_rel) > 1;
+            }
+
+            void await_resume()
+            {
+               // Back to one reference for the next join(), unless await_ready() skipped the decrement.
+               scope_.count_.store(1, std::memory_order_release);
+               std::exception_ptr first;
+               {
+                  std::lock_guard lock(scope_.mutex_);
+                  if (!scope_.exceptions_.empty()) {
+                     first = scope_.exceptions_.front();
+                     scope_.exceptions_.clear();
+                  }
+               }
+               if (first) {
+                  std::rethrow_exception(first);
+               }
+            }
+         };
+         return awaiter{*this};
+      }
+   };
+
+   namespace detail
+   {
+      inline auto scope_task::promise_type::final_suspend() noexcept
+      {
+         struct awaiter
+         {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+            {
+               auto& scope = h.promise().scope_;
+               h.destroy();
+               return scope.arrive();
+            }
+            void await_resume() noexcept {}
+         };
+         return awaiter{};
+      }
+   } // namespace detail
+} // namespace rdmapp
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+#include "rdmapp/detail/util.h"
+#include "rdmapp/detail/waiter_queue.h"
+#include "rdmapp/executor.h"
+
+namespace rdmapp
+{
+   /**
+    * @brief A counting semaphore that suspends the awaiting coroutine instead of blocking its thread, such as to cap
+    * the number of operations outstanding on a queue pair. Waiters are served in FIFO order, and release() hands its
+    * permits to them directly, so a coroutine arriving later cannot overtake them.
+    *
+    * Released waiters are resumed on the executor if one is given, and on the thread calling release() otherwise.
+    */
+   class async_semaphore : public noncopyable
+   {
+      std::mutex mutex_;
+      size_t count_;
+      detail::waiter_queue waiters_;
+      std::shared_ptr<executor> exec_;
+
+     public:
+      /**
+       * @brief Construct a new semaphore.
+       *
+       * @param count The number of permits available at first.
+       * @param exec (Optional) The executor to resume released waiters on.
+       */
+      explicit async_semaphore(size_t count, std::shared_ptr<executor> exec = nullptr)
+         : count_(count), exec_(std::move(exec))
+      {}
+
+      /**
+       * @brief Take a permit if one is available, without waiting.
+       *
+       * @return true If a permit was taken.
+       */
+      bool try_acquire()
+      {
+         std::lock_guard lock(mutex_);
+         if (count_ == 0) {
+            return false;
+         }
+         --count_;
+         return true;
+      }
+
+      /**
+       * @brief Take a permit, waiting for one to be released if none is available.
+       *
+       * @return auto An awaitable that returns once the permit is taken.
+       */
+      [[nodiscard]] auto acquire()
+      {
+         struct awaiter : public detail::async_waiter
+         {
+            async_semaphore& sem_;
+
+            explicit awaiter(async_semaphore& sem) : sem_(sem) {}
+
+            bool await_ready() { return sem_.try_acquire(); }
+
+            bool await_suspend(std::coroutine_handle<> h)
+            {
+               std::lock_guard lock(sem_.mutex_);
+               if (sem_.count_ > 0) {
+                  --sem_.count_;
+                  return false;
+               }
+               h_ = h;
+               sem_.waiters_.push_back(*this);
+               return true;
+            }
+
+            void await_resume() const noexcept {}
+         };
+         return awaiter(*this);
+      }
+
+      /**
+       * @brief Return permits, handing them to waiters first.
+       *
+       * @param n The number of permits.
+       */
+      void release(size_t n = 1)
+      {
+         detail::waiter_queue released;
+         {
+            std::lock_guard lock(mutex_);
+            for (; n > 0 && !waiters_.empty(); --n) {
+               released.push_back(*waiters_.pop_front());
+            }
+            count_ += n;
+         }
+         while (auto waiter = released.pop_front()) {
+            detail::resume_waiter(exec_.get(), waiter->h_);
+         }
+      }
+
+      // The number of permits available. It may be stale by the time it is used.
+      size_t available()
+      {
+         std::lock_guard lock(mutex_);
+         return count_;
+      }
+   };
+} // namespace rdmapp
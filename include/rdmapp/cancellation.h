@@ -0,0 +1,154 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace rdmapp
+{
+   /**
+    * @brief An intrusive cancellation callback, registered with a cancellation_token by whoever owns it. It must stay
+    * put while it is registered.
+    */
+   struct cancellation_record
+   {
+      using cancel_fn = void (*)(cancellation_record* self);
+      cancel_fn on_cancel{}; // Called by the thread that cancels the source, unless deregistered first.
+
+      explicit cancellation_record(cancel_fn on_cancel = nullptr) : on_cancel(on_cancel) {}
+      cancellation_record(const cancellation_record&) = delete;
+      cancellation_record& operator=(const cancellation_record&) = delete;
+
+     private:
+      friend class cancellation_token;
+      friend class cancellation_source;
+      cancellation_record* prev_{};
+      cancellation_record* next_{};
+      bool registered_{};
+   };
+
+   namespace detail
+   {
+      // Shared by a cancellation_source and its tokens.
+      struct cancellation_state
+      {
+         std::mutex mutex_;
+         std::atomic<bool> cancelled_{};
+         cancellation_record* head_{};
+      };
+   } // namespace detail
+
+   /**
+    * @brief A handle to observe a cancellation_source. A default-constructed token is never cancelled.
+    */
+   class cancellation_token
+   {
+      std::shared_ptr<detail::cancellation_state> state_;
+
+      friend class cancellation_source;
+      explicit cancellation_token(std::shared_ptr<detail::cancellation_state> state) : state_(std::move(state)) {}
+
+     public:
+      cancellation_token() = default;
+
+      // Whether the token belongs to a source, and may therefore be cancelled.
+      bool can_be_cancelled() const { return state_ != nullptr; }
+
+      bool cancelled() const { return state_ != nullptr && state_->cancelled_.load(std::memory_order_acquire); }
+
+      /**
+       * @brief Register a callback to run once the source is cancelled.
+       *
+       * @param record The callback, which must not be registered already.
+       * @return true If the callback was registered.
+       * @return false If the source was already cancelled, or the token cannot be cancelled. The callback is not run.
+       */
+      bool register_callback(cancellation_record& record) const
+      {
+         if (state_ == nullptr) {
+            return false;
+         }
+         std::lock_guard lock(state_->mutex_);
+         if (state_->cancelled_.load(std::memory_order_relaxed)) {
+            return false;
+         }
+         record.prev_ = nullptr;
+         record.next_ = state_->head_;
+         if (state_->head_ != nullptr) {
+            state_->head_->prev_ = &record;
+         }
+         state_->head_ = &record;
+         record.registered_ = true;
+         return true;
+      }
+
+      /**
+       * @brief Deregister a callback. If it is running on another thread, wait for it to finish.
+       *
+       * @param record The callback.
+       * @return true If the callback was deregistered before running.
+       */
+      bool deregister_callback(cancellation_record& record) const
+      {
+         if (state_ == nullptr) {
+            return false;
+         }
+         std::lock_guard lock(state_->mutex_);
+         if (!record.registered_) {
+            return false;
+         }
+         if (record.prev_ != nullptr) {
+            record.prev_->next_ = record.next_;
+         }
+         else {
+            state_->head_ = record.next_;
+         }
+         if (record.next_ != nullptr) {
+            record.next_->prev_ = record.prev_;
+         }
+         record.prev_ = record.next_ = nullptr;
+         record.registered_ = false;
+         return true;
+      }
+   };
+
+   /**
+    * @brief The side of a cooperative cancellation that requests it. Copies share the same state, and every token
+    * handed out observes it.
+    */
+   class cancellation_source
+   {
+      std::shared_ptr<detail::cancellation_state> state_ = std::make_shared<detail::cancellation_state>();
+
+     public:
+      cancellation_token token() const { return cancellation_token(state_); }
+
+      bool cancelled() const { return state_->cancelled_.load(std::memory_order_acquire); }
+
+      /**
+       * @brief Request cancellation and run the registered callbacks on the calling thread. The callbacks run with
+       * the source locked, so they must not register or deregister callbacks of the same source.
+       *
+       * @return true If this call cancelled the source.
+       * @return false If it was already cancelled.
+       */
+      bool cancel()
+      {
+         std::lock_guard lock(state_->mutex_);
+         if (state_->cancelled_.exchange(true, std::memory_order_acq_rel)) {
+            return false;
+         }
+         while (auto record = state_->head_) {
+            state_->head_ = record->next_;
+            if (state_->head_ != nullptr) {
+               state_->head_->prev_ = nullptr;
+            }
+            record->prev_ = record->next_ = nullptr;
+            record->registered_ = false;
+            record->on_cancel(record);
+         }
+         return true;
+      }
+   };
+} // namespace rdmapp
@@ -1,7 +1,15 @@
 #pragma once
 
+#include <fcntl.h>
 #include <infiniband/verbs.h>
 
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+
+#include "rdmapp/detail/debug.h"
 #include "rdmapp/device.h"
 
 namespace rdmapp
@@ -18,18 +26,155 @@ namespace rdmapp
       }
    };
 
+   struct comp_channel_deleter final
+   {
+      void operator()(ibv_comp_channel* channel) const
+      {
+         if (channel) {
+            if (auto rc = ::ibv_destroy_comp_channel(channel); rc != 0) {
+               RDMAPP_LOG_ERROR("failed to destroy completion channel %p: %s", reinterpret_cast<void*>(channel),
+                                std::strerror(errno));
+            }
+         }
+      }
+   };
+
+   // Hardware timestamps of a completion entry. Fields the device cannot provide are left zero.
+   struct completion_timestamp
+   {
+      uint64_t hca_cycles{}; // Raw HCA clock cycles, convert with hca_clock.
+      uint64_t wallclock_ns{}; // Wallclock time in nanoseconds, if the device supports it.
+   };
+
    struct completion_queue final
    {
       std::shared_ptr<rdmapp::device> device{}; // The device to use.
       size_t num_cqe{128}; // The number of completion entries to allocate.
+      bool timestamps{}; // If set, create an extended CQ that reports hardware completion timestamps.
+      bool events{}; // If set, create a completion channel so that completions can be waited for on its fd.
+      bool wallclock{}; // Set once created if the extended CQ also reports wallclock timestamps.
+      ibv_cq_ex* cq_ex{}; // The extended CQ, only set when timestamps are enabled.
+      size_t attached_cqe{}; // The completion entries needed by all attached queue pairs.
+      std::mutex attach_mutex{}; // Guards num_cqe and attached_cqe.
+
+      std::unique_ptr<ibv_comp_channel, comp_channel_deleter> channel{[&]() -> ibv_comp_channel* {
+         if (!events) {
+            return nullptr;
+         }
+         check_ptr(device, "device pointer null");
+         auto channel = ::ibv_create_comp_channel(device->ctx);
+         check_ptr(channel, "failed to create completion channel");
+         int flags = ::fcntl(channel->fd, F_GETFL);
+         if (flags < 0 || ::fcntl(channel->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+            comp_channel_deleter()(channel);
+            throw std::runtime_error("failed to make completion channel non-blocking");
+         }
+         return channel;
+      }()};
 
       std::unique_ptr<ibv_cq, cq_deleter> cq{[&] {
          check_ptr(device, "device pointer null");
-         ibv_cq* cq = ::ibv_create_cq(device->ctx, num_cqe, this, nullptr, 0);
+         if (timestamps) {
+            return create_cq_ex();
+         }
+         ibv_cq* cq = ::ibv_create_cq(device->ctx, num_cqe, this, channel.get(), 0);
          check_ptr(cq, "failed to create cq");
          return cq;
       }()};
 
+      /**
+       * @brief Account for a queue pair that may post up to n_cqe signaled work
+       * requests to this CQ. The CQ is grown with ibv_resize_cq if the attached
+       * queue pairs could otherwise overrun it.
+       *
+       * @param n_cqe The number of completion entries the queue pair may need.
+       */
+      void attach(size_t n_cqe)
+      {
+         std::lock_guard lock(attach_mutex);
+         attached_cqe += n_cqe;
+         if (attached_cqe <= num_cqe) {
+            return;
+         }
+         size_t max_cqe = device->attr_ex.orig_attr.max_cqe;
+         if (attached_cqe > max_cqe) {
+            attached_cqe -= n_cqe;
+            format_throw("cq cannot hold {} entries, device supports at most {}", attached_cqe + n_cqe, max_cqe);
+         }
+         // Grow geometrically so that attaching many queue pairs does not resize every time.
+         auto target = std::min(std::max(attached_cqe, num_cqe * 2), max_cqe);
+         if (auto rc = ::ibv_resize_cq(cq.get(), target); rc != 0) [[unlikely]] {
+            attached_cqe -= n_cqe;
+            format_throw("failed to resize cq to {} entries: {} (rc={})", target, strerror(rc), rc);
+         }
+         num_cqe = cq->cqe;
+         RDMAPP_LOG_DEBUG("resized cq %p to %zu entries", reinterpret_cast<void*>(cq.get()), num_cqe);
+      }
+
+      /**
+       * @brief Release the completion entries accounted by attach(). The CQ is
+       * not shrunk.
+       *
+       * @param n_cqe The number of completion entries passed to attach().
+       */
+      void detach(size_t n_cqe)
+      {
+         std::lock_guard lock(attach_mutex);
+         attached_cqe -= std::min(n_cqe, attached_cqe);
+      }
+
+      /**
+       * @brief Set completion event moderation. An event is generated once count
+       * completions have accumulated or period microseconds have passed since the
+       * first unreported one, whichever comes first. Only completion events are
+       * moderated, polling is unaffected.
+       *
+       * @param count The number of completions per event.
+       * @param period The maximum delay of an event in microseconds.
+       */
+      void moderate(uint16_t count, uint16_t period)
+      {
+         ibv_modify_cq_attr attr{};
+         attr.attr_mask = IBV_CQ_ATTR_MODERATE;
+         attr.moderate.cq_count = count;
+         attr.moderate.cq_period = period;
+         check_rc(::ibv_modify_cq(cq.get(), &attr), "failed to set cq moderation");
+      }
+
+      // The fd of the completion channel, readable when a completion event is pending.
+      int event_fd() const
+      {
+         assert(channel);
+         return channel->fd;
+      }
+
+      /**
+       * @brief Arm the CQ so that the next completion generates an event on the
+       * completion channel. Poll the CQ again after arming to catch completions
+       * that arrived in between.
+       */
+      void request_notify() { check_rc(::ibv_req_notify_cq(cq.get(), 0), "failed to request cq notification"); }
+
+      /**
+       * @brief Consume a pending completion event without blocking.
+       *
+       * @return true If an event was consumed.
+       * @return false If no event is pending.
+       */
+      bool consume_event()
+      {
+         ibv_cq* ev_cq = nullptr;
+         void* ev_ctx = nullptr;
+         if (::ibv_get_cq_event(channel.get(), &ev_cq, &ev_ctx) != 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+               return false;
+            }
+            format_throw("failed to get cq event: {} (errno={})", std::strerror(errno), errno);
+         }
+         ::ibv_ack_cq_events(ev_cq, 1);
+         return true;
+      }
+
       /**
        * @brief Poll the completion queue.
        *
@@ -56,11 +201,108 @@ namespace rdmapp
 
       int poll(ibv_wc* wc, int count)
       {
+         if (cq_ex) {
+            return poll_ex(wc, nullptr, count);
+         }
          int rc = ::ibv_poll_cq(cq.get(), count, wc);
          if (rc < 0) {
             format_throw("failed to poll cq: {} (rc={})", strerror(rc), rc);
          }
          return rc;
       }
+
+      /**
+       * @brief Poll the completion queue along with hardware timestamps.
+       *
+       * @param wc Filled with up to count completion entries.
+       * @param ts Filled with the timestamps of the entries. They are zero unless timestamps are enabled.
+       * @param count The maximum number of entries to poll.
+       * @return int The number of completion entries. 0 means no completion entry.
+       */
+      int poll(ibv_wc* wc, completion_timestamp* ts, int count)
+      {
+         if (cq_ex) {
+            return poll_ex(wc, ts, count);
+         }
+         int rc = poll(wc, count);
+         std::fill_n(ts, rc, completion_timestamp{});
+         return rc;
+      }
+
+     private:
+      ibv_cq* create_cq_ex()
+      {
+         ibv_cq_init_attr_ex attr{};
+         attr.cqe = num_cqe;
+         attr.cq_context = this;
+         attr.channel = channel.get();
+         attr.wc_flags = uint64_t(IBV_WC_STANDARD_FLAGS) | uint64_t(IBV_WC_EX_WITH_COMPLETION_TIMESTAMP) |
+                         uint64_t(IBV_WC_EX_WITH_COMPLETION_TIMESTAMP_WALLCLOCK);
+         cq_ex = ::ibv_create_cq_ex(device->ctx, &attr);
+         wallclock = cq_ex != nullptr;
+         if (!cq_ex) {
+            // Wallclock timestamps are optional, fall back to raw HCA cycles only.
+            attr.wc_flags &= ~uint64_t(IBV_WC_EX_WITH_COMPLETION_TIMESTAMP_WALLCLOCK);
+            cq_ex = ::ibv_create_cq_ex(device->ctx, &attr);
+         }
+         check_ptr(cq_ex, "failed to create extended cq with completion timestamps");
+         return ::ibv_cq_ex_to_cq(cq_ex);
+      }
+
+      // Read the current entry of the extended CQ into a plain work completion.
+      void read_wc_ex(ibv_wc& wc)
+      {
+         wc = {};
+         wc.wr_id = cq_ex->wr_id;
+         wc.status = cq_ex->status;
+         wc.vendor_err = ::ibv_wc_read_vendor_err(cq_ex);
+         wc.qp_num = ::ibv_wc_read_qp_num(cq_ex);
+         if (wc.status != IBV_WC_SUCCESS) {
+            return;
+         }
+         wc.opcode = ::ibv_wc_read_opcode(cq_ex);
+         wc.byte_len = ::ibv_wc_read_byte_len(cq_ex);
+         wc.wc_flags = ::ibv_wc_read_wc_flags(cq_ex);
+         if (wc.wc_flags & IBV_WC_WITH_IMM) {
+            wc.imm_data = ::ibv_wc_read_imm_data(cq_ex);
+         }
+         wc.src_qp = ::ibv_wc_read_src_qp(cq_ex);
+         wc.slid = ::ibv_wc_read_slid(cq_ex);
+         wc.sl = ::ibv_wc_read_sl(cq_ex);
+         wc.dlid_path_bits = ::ibv_wc_read_dlid_path_bits(cq_ex);
+      }
+
+      int poll_ex(ibv_wc* wc, completion_timestamp* ts, int count)
+      {
+         ibv_poll_cq_attr attr{};
+         int rc = ::ibv_start_poll(cq_ex, &attr);
+         if (rc == ENOENT) {
+            return 0;
+         }
+         if (rc != 0) [[unlikely]] {
+            format_throw("failed to poll cq: {} (rc={})", strerror(rc), rc);
+         }
+         int n = 0;
+         while (true) {
+            read_wc_ex(wc[n]);
+            if (ts) {
+               ts[n].hca_cycles = ::ibv_wc_read_completion_ts(cq_ex);
+               ts[n].wallclock_ns = wallclock ? ::ibv_wc_read_completion_wallclock_ns(cq_ex) : 0;
+            }
+            if (++n == count) {
+               break;
+            }
+            rc = ::ibv_next_poll(cq_ex);
+            if (rc == ENOENT) {
+               break;
+            }
+            if (rc != 0) [[unlikely]] {
+               ::ibv_end_poll(cq_ex);
+               format_throw("failed to poll cq: {} (rc={})", strerror(rc), rc);
+            }
+         }
+         ::ibv_end_poll(cq_ex);
+         return n;
+      }
    };
 }
\ No newline at end of file
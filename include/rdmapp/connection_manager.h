@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rdmapp/completion_queue.h"
+#include "rdmapp/detail/util.h"
+#include "rdmapp/protected_domain.h"
+#include "rdmapp/queue_pair.h"
+#include "rdmapp/shared_receive_queue.h"
+#include "rdmapp/task.h"
+
+namespace rdmapp
+{
+   namespace detail
+   {
+      struct cm_channel;
+      struct cm_id;
+   } // namespace detail
+
+   /**
+    * @brief This class establishes Queue Pairs with the RDMA connection manager
+    * (librdmacm) instead of a TCP handshake. Addresses and routes are resolved by
+    * the connection manager, which also exchanges the Queue Pair parameters, so it
+    * works on InfiniBand, RoCE and soft-RoCE alike.
+    *
+    * Events of the connection manager are read by a thread of its own, which
+    * resumes the coroutines waiting for them. It is only built when rdmapp is
+    * configured with RDMAPP_BUILD_RDMACM.
+    */
+   class connection_manager : public noncopyable
+   {
+      std::shared_ptr<detail::cm_channel> channel_;
+      std::shared_ptr<protected_domain> pd_;
+      std::shared_ptr<completion_queue> recv_cq_;
+      std::shared_ptr<completion_queue> send_cq_;
+      std::shared_ptr<shared_receive_queue> srq_;
+      std::unique_ptr<detail::cm_id> listener_;
+
+      std::shared_ptr<queue_pair> create_qp(detail::cm_id& id);
+
+     public:
+      // The largest user payload carried by a connect request and by an accept.
+      static constexpr size_t kMaxConnectPrivateData = 55;
+      static constexpr size_t kMaxAcceptPrivateData = 195;
+
+      /**
+       * @brief Construct a new connection manager object.
+       *
+       * @param pd The protection domain for all new Queue Pairs. Connections must
+       * resolve to its device.
+       * @param recv_cq The recv completion queue to use for new Queue Pairs.
+       * @param send_cq The send completion queue to use for new Queue Pairs.
+       * @param srq (Optional) The shared receive queue to use for new Queue Pairs.
+       */
+      connection_manager(std::shared_ptr<protected_domain> pd, std::shared_ptr<completion_queue> recv_cq,
+                         std::shared_ptr<completion_queue> send_cq,
+                         std::shared_ptr<shared_receive_queue> srq = nullptr);
+
+      /**
+       * @brief Construct a new connection manager object.
+       *
+       * @param pd The protection domain for all new Queue Pairs.
+       * @param cq The send/recv completion queue to use for new Queue Pairs.
+       * @param srq (Optional) The shared receive queue to use for new Queue Pairs.
+       */
+      connection_manager(std::shared_ptr<protected_domain> pd, std::shared_ptr<completion_queue> cq,
+                         std::shared_ptr<shared_receive_queue> srq = nullptr);
+
+      /**
+       * @brief Start listening for connection requests.
+       *
+       * @param hostname The address to listen on, or an empty string for all of
+       * them.
+       * @param port The port to listen on.
+       * @param backlog The number of pending connection requests to queue.
+       */
+      void listen(const std::string& hostname, uint16_t port, int backlog = 128);
+
+      /**
+       * @brief This function is used to accept the next connection request. It
+       * must not be awaited concurrently.
+       *
+       * @param private_data Data handed to the remote, at most
+       * kMaxAcceptPrivateData bytes.
+       * @return task<std::shared_ptr<queue_pair>> A coroutine that returns the
+       * new Queue Pair in the RTS state. Its user data holds the private data of
+       * the request. The connection is torn down once it is released.
+       */
+      task<std::shared_ptr<queue_pair>> accept(std::vector<uint8_t> private_data = {});
+
+      /**
+       * @brief This function is used to connect to a remote connection manager.
+       *
+       * @param hostname The hostname to connect to.
+       * @param port The port to connect to.
+       * @param private_data Data handed to the remote, at most
+       * kMaxConnectPrivateData bytes.
+       * @return task<std::shared_ptr<queue_pair>> A coroutine that returns the
+       * new Queue Pair in the RTS state. Its user data holds the private data of
+       * the accept. The connection is torn down once it is released.
+       */
+      task<std::shared_ptr<queue_pair>> connect(const std::string& hostname, uint16_t port,
+                                                std::vector<uint8_t> private_data = {});
+
+      /**
+       * @brief Stop the event thread and reject pending connection requests.
+       * Coroutines still waiting for an event are not resumed.
+       */
+      ~connection_manager();
+   };
+} // namespace rdmapp
@@ -4,12 +4,14 @@
 
 #include <atomic>
 #include <functional>
+#include <span>
 #include <thread>
 
 #include "rdmapp/completion_queue.h"
 #include "rdmapp/detail/debug.h"
 #include "rdmapp/detail/util.h"
 #include "rdmapp/executor.h"
+#include "rdmapp/timer_wheel.h"
 
 namespace rdmapp
 {
@@ -17,11 +19,14 @@ namespace rdmapp
    struct cq_poller
    {
       std::shared_ptr<completion_queue> cq{}; // The completion queue to poll.
-      std::shared_ptr<executor> exec{}; // The executor to use to process the completion entries.
+      std::shared_ptr<executor> exec = std::make_shared<executor>(); // The executor to use to process the completion entries.
       size_t batch_size = 16; // The number of completion entries to poll at a time.
       std::atomic<bool> stopped{};
-      std::thread poller_thread{&cq_poller::worker, this};
       std::vector<ibv_wc> wc_vec = std::vector<ibv_wc>(batch_size);
+      std::vector<completion_timestamp> ts_vec = std::vector<completion_timestamp>(batch_size);
+      // Deadlines of operations awaited with_deadline() or with_timeout(), advanced between polls.
+      std::shared_ptr<timer_wheel> timers = std::make_shared<timer_wheel>();
+      std::thread poller_thread{&cq_poller::worker, this}; // Started last so that all members above are initialized.
 
       ~cq_poller()
       {
@@ -33,12 +38,20 @@ namespace rdmapp
       {
          while (!stopped) {
             try {
-               auto nr_wc = cq->poll(wc_vec);
+               timers->advance();
+               auto nr_wc = cq->timestamps ? cq->poll(wc_vec.data(), ts_vec.data(), wc_vec.size()) : cq->poll(wc_vec);
+               if (nr_wc == 0) {
+                  continue;
+               }
                for (int i = 0; i < nr_wc; ++i) {
                   auto& wc = wc_vec[i];
                   RDMAPP_LOG_TRACE("polled cqe wr_id=%p status=%d", reinterpret_cast<void*>(wc.wr_id), wc.status);
-                  exec->process_wc(wc);
+                  if (cq->timestamps) {
+                     // Published to the executor thread by the release in the work queue.
+                     completion_record::from_wr_id(wc.wr_id)->timestamp_ = ts_vec[i];
+                  }
                }
+               exec->process_wc(std::span<const ibv_wc>(wc_vec.data(), nr_wc));
             }
             catch (const std::runtime_error& e) {
                RDMAPP_LOG_ERROR("%s", e.what());
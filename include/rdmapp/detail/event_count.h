@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace rdmapp::detail
+{
+   // Hint to the CPU that we are in a spin-wait loop.
+   static inline void cpu_relax()
+   {
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#elif defined(__aarch64__)
+      asm volatile("yield" ::: "memory");
+#endif
+   }
+
+   /**
+    * @brief A lightweight parking primitive for lock-free structures.
+    *
+    * A waiter announces itself with prepare_wait(), re-checks its condition and then either calls cancel_wait() or
+    * wait(). A notifier publishes its state change before calling notify_*(), which only touches the futex when
+    * somebody is actually parked.
+    */
+   struct event_count
+   {
+      /**
+       * @brief Announce the intention to wait.
+       *
+       * @return uint32_t The epoch to pass to wait().
+       */
+      uint32_t prepare_wait()
+      {
+         waiters_.fetch_add(1, std::memory_order_seq_cst);
+         return epoch_.load(std::memory_order_seq_cst);
+      }
+
+      // Withdraw a prepare_wait() because the condition became true.
+      void cancel_wait() { waiters_.fetch_sub(1, std::memory_order_seq_cst); }
+
+      /**
+       * @brief Park until the epoch moves past the one returned by prepare_wait().
+       *
+       * @param epoch The epoch returned by prepare_wait().
+       */
+      void wait(uint32_t epoch)
+      {
+         epoch_.wait(epoch, std::memory_order_seq_cst);
+         waiters_.fetch_sub(1, std::memory_order_seq_cst);
+      }
+
+      void notify_one()
+      {
+         if (has_waiters()) {
+            epoch_.fetch_add(1, std::memory_order_seq_cst);
+            epoch_.notify_one();
+         }
+      }
+
+      void notify_all()
+      {
+         if (has_waiters()) {
+            epoch_.fetch_add(1, std::memory_order_seq_cst);
+            epoch_.notify_all();
+         }
+      }
+
+     private:
+      bool has_waiters()
+      {
+         std::atomic_thread_fence(std::memory_order_seq_cst);
+         return waiters_.load(std::memory_order_seq_cst) != 0;
+      }
+
+      std::atomic<uint32_t> epoch_{};
+      std::atomic<uint32_t> waiters_{};
+   };
+} // namespace rdmapp::detail
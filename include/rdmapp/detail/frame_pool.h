@@ -0,0 +1,325 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+
+namespace rdmapp
+{
+   /**
+    * @brief Counters of the coroutine frame pool of the calling thread.
+    *
+    * Frames are counted by the thread that allocates or frees them, so live may drop below zero on a thread that
+    * mostly frees frames created elsewhere, such as the thread of a cq_poller.
+    */
+   struct frame_pool_stats
+   {
+      // Allocations served from a free list.
+      uint64_t hits;
+      // Allocations that went to operator new, because their bucket was empty or the frame is too large to pool.
+      uint64_t misses;
+      // Frames allocated minus frames freed on this thread.
+      int64_t live;
+      // The highest value live has reached.
+      int64_t peak;
+
+      double hit_rate() const
+      {
+         auto total = hits + misses;
+         return total == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(total);
+      }
+   };
+
+   namespace detail
+   {
+      /**
+       * @brief A thread-local cache of coroutine frames, bucketed by size.
+       *
+       * Frames are rounded up to kGranularity bytes and freed frames are kept on a free list per size class, so a
+       * thread that keeps creating short-lived coroutines of the same few shapes stops calling malloc once the lists
+       * are warm. Each frame records the pool it came from, and a frame freed on another thread, such as the thread of
+       * a cq_poller finishing a coroutine started on an event loop, is pushed onto a lock-free return list of that
+       * pool. The owning thread takes the list back into its buckets when one runs empty. Each bucket holds at most
+       * kMaxCachedFrames frames, and the buckets are released when the thread exits.
+       */
+      class frame_pool
+      {
+        public:
+         static constexpr size_t kGranularity = 64;
+         static constexpr size_t kBucketCount = 32;
+         static constexpr size_t kMaxPooledSize = kGranularity * kBucketCount;
+         static constexpr size_t kMaxCachedFrames = 1024;
+
+         // Allocate a frame of size bytes, which must be a multiple of the alignment of a pointer.
+         static void* allocate(size_t size)
+         {
+            auto index = bucket_index(size + sizeof(return_list*));
+            if (destroyed_) {
+               return tag(::operator new(block_size(size, index)), size, nullptr);
+            }
+            auto& pool = instance_;
+            if (++pool.stats_.live > pool.stats_.peak) {
+               pool.stats_.peak = pool.stats_.live;
+            }
+            if (index < kBucketCount) {
+               auto& bucket = pool.buckets_[index];
+               if (bucket.head == nullptr) {
+                  pool.take_returned();
+               }
+               if (bucket.head != nullptr) {
+                  auto frame = bucket.head;
+                  bucket.head = frame->next;
+                  --bucket.count;
+                  ++pool.stats_.hits;
+                  return tag(frame, size, pool.returns_);
+               }
+            }
+            ++pool.stats_.misses;
+            return tag(::operator new(block_size(size, index)), size, index < kBucketCount ? pool.returns_ : nullptr);
+         }
+
+         // Free a frame allocated with the same size, on any thread.
+         static void deallocate(void* p, size_t size)
+         {
+            auto index = bucket_index(size + sizeof(return_list*));
+            return_list* owner;
+            std::memcpy(&owner, static_cast<std::byte*>(p) + size, sizeof(owner));
+            if (!destroyed_) {
+               --instance_.stats_.live;
+            }
+            if (owner == nullptr) {
+               ::operator delete(p, block_size(size, index));
+               return;
+            }
+            if (destroyed_ || owner != instance_.returns_) {
+               // Back to the thread that allocated it, which keeps missing otherwise.
+               auto frame = ::new (p) free_frame{owner->head.load(std::memory_order_relaxed), index};
+               while (!owner->head.compare_exchange_weak(frame->next, frame, std::memory_order_release,
+                                                         std::memory_order_relaxed)) {
+               }
+               return;
+            }
+            instance_.cache(p, index);
+         }
+
+         static frame_pool_stats stats() { return destroyed_ ? frame_pool_stats{} : instance_.stats_; }
+
+         frame_pool() : returns_(acquire_return_list()) {}
+
+         ~frame_pool()
+         {
+            destroyed_ = true;
+            take_returned();
+            for (size_t i = 0; i < kBucketCount; ++i) {
+               while (buckets_[i].head != nullptr) {
+                  auto frame = buckets_[i].head;
+                  buckets_[i].head = frame->next;
+                  ::operator delete(frame, (i + 1) * kGranularity);
+               }
+            }
+            // Frames still out go to whichever thread takes the list over.
+            std::lock_guard lock(registry_mutex_);
+            returns_->next_unused = unused_lists_;
+            unused_lists_ = returns_;
+         }
+
+        private:
+         struct free_frame
+         {
+            free_frame* next;
+            size_t index; // The bucket, for frames on a return list.
+         };
+
+         struct bucket
+         {
+            free_frame* head;
+            size_t count;
+         };
+
+         // Frames freed on other threads. Lists outlive their threads and are reused by later ones, so a frame can
+         // always be returned to the list it records.
+         struct return_list
+         {
+            std::atomic<free_frame*> head{};
+            return_list* next_unused{};
+         };
+
+         static size_t bucket_index(size_t size) { return size == 0 ? 0 : (size - 1) / kGranularity; }
+
+         static size_t block_size(size_t size, size_t index)
+         {
+            return index < kBucketCount ? (index + 1) * kGranularity : size + sizeof(return_list*);
+         }
+
+         static void* tag(void* frame, size_t size, return_list* owner)
+         {
+            std::memcpy(static_cast<std::byte*>(frame) + size, &owner, sizeof(owner));
+            return frame;
+         }
+
+         static return_list* acquire_return_list()
+         {
+            std::lock_guard lock(registry_mutex_);
+            if (unused_lists_ == nullptr) {
+               return new return_list;
+            }
+            auto list = unused_lists_;
+            unused_lists_ = list->next_unused;
+            return list;
+         }
+
+         void cache(void* frame, size_t index)
+         {
+            auto& bucket = buckets_[index];
+            if (bucket.count >= kMaxCachedFrames) {
+               ::operator delete(frame, (index + 1) * kGranularity);
+               return;
+            }
+            bucket.head = ::new (frame) free_frame{bucket.head, index};
+            ++bucket.count;
+         }
+
+         void take_returned()
+         {
+            if (returns_->head.load(std::memory_order_relaxed) == nullptr) {
+               return;
+            }
+            auto frame = returns_->head.exchange(nullptr, std::memory_order_acquire);
+            while (frame != nullptr) {
+               auto next = frame->next;
+               if (destroyed_) {
+                  ::operator delete(frame, (frame->index + 1) * kGranularity);
+               }
+               else {
+                  cache(frame, frame->index);
+               }
+               frame = next;
+            }
+         }
+
+         bucket buckets_[kBucketCount]{};
+         frame_pool_stats stats_{};
+         return_list* returns_;
+
+         static thread_local frame_pool instance_;
+         // Frames may still be freed by thread_local destructors that run after the pool is gone.
+         static thread_local bool destroyed_;
+         static inline std::mutex registry_mutex_;
+         static inline return_list* unused_lists_{};
+      };
+
+      inline thread_local frame_pool frame_pool::instance_;
+      inline thread_local bool frame_pool::destroyed_ = false;
+
+      /**
+       * @brief The allocation functions of coroutine promises.
+       *
+       * Frames come from the thread-local frame_pool, unless the coroutine takes std::allocator_arg followed by an
+       * allocator as its leading parameters (after the object parameter of a member function), in which case the
+       * frame is allocated with a copy of that allocator. Every frame is followed by a trailer recording which of the
+       * two released it.
+       */
+      struct pooled_frame
+      {
+         static void* operator new(size_t size)
+         {
+            auto offset = trailer_offset(size);
+            auto frame = static_cast<std::byte*>(frame_pool::allocate(offset + sizeof(release_fn)));
+            release_fn release = nullptr;
+            std::memcpy(frame + offset, &release, sizeof(release));
+            return frame;
+         }
+
+         template <class Alloc, class... Args>
+         static void* operator new(size_t size, std::allocator_arg_t, const Alloc& alloc, const Args&...)
+         {
+            return allocate_with(size, alloc);
+         }
+
+         template <class Self, class Alloc, class... Args>
+         static void* operator new(size_t size, const Self&, std::allocator_arg_t, const Alloc& alloc, const Args&...)
+         {
+            return allocate_with(size, alloc);
+         }
+
+         static void operator delete(void* frame, size_t size)
+         {
+            auto offset = trailer_offset(size);
+            release_fn release;
+            std::memcpy(&release, static_cast<std::byte*>(frame) + offset, sizeof(release));
+            if (release == nullptr) {
+               frame_pool::deallocate(frame, offset + sizeof(release_fn));
+            }
+            else {
+               release(frame, offset);
+            }
+         }
+
+        private:
+         using release_fn = void (*)(void* frame, size_t trailer_offset);
+
+         // The unit user allocators allocate in, so that frames get the alignment of operator new.
+         struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) frame_unit
+         {
+            std::byte bytes[__STDCPP_DEFAULT_NEW_ALIGNMENT__];
+         };
+
+         static constexpr size_t align_up(size_t n, size_t alignment) { return (n + alignment - 1) & ~(alignment - 1); }
+
+         static constexpr size_t trailer_offset(size_t size) { return align_up(size, alignof(release_fn)); }
+
+         template <class UnitAlloc>
+         static constexpr size_t allocator_offset(size_t offset)
+         {
+            return align_up(offset + sizeof(release_fn), alignof(UnitAlloc));
+         }
+
+         template <class UnitAlloc>
+         static constexpr size_t unit_count(size_t offset)
+         {
+            return (allocator_offset<UnitAlloc>(offset) + sizeof(UnitAlloc) + sizeof(frame_unit) - 1) /
+                   sizeof(frame_unit);
+         }
+
+         // Not inlined, so GCC does not pair the operator new inside the allocator with the operator delete above.
+         template <class Alloc>
+         [[gnu::noinline]] static void* allocate_with(size_t size, const Alloc& alloc)
+         {
+            using unit_alloc = typename std::allocator_traits<Alloc>::template rebind_alloc<frame_unit>;
+            static_assert(alignof(unit_alloc) <= alignof(frame_unit), "allocator is over-aligned");
+            auto offset = trailer_offset(size);
+            unit_alloc units(alloc);
+            auto frame = reinterpret_cast<std::byte*>(
+               std::to_address(std::allocator_traits<unit_alloc>::allocate(units, unit_count<unit_alloc>(offset))));
+            ::new (frame + allocator_offset<unit_alloc>(offset)) unit_alloc(std::move(units));
+            release_fn release = &release_with<unit_alloc>;
+            std::memcpy(frame + offset, &release, sizeof(release));
+            return frame;
+         }
+
+         template <class UnitAlloc>
+         static void release_with(void* frame, size_t offset)
+         {
+            auto bytes = static_cast<std::byte*>(frame);
+            auto stored = std::launder(reinterpret_cast<UnitAlloc*>(bytes + allocator_offset<UnitAlloc>(offset)));
+            UnitAlloc units(std::move(*stored));
+            stored->~UnitAlloc();
+            using pointer = typename std::allocator_traits<UnitAlloc>::pointer;
+            std::allocator_traits<UnitAlloc>::deallocate(
+               units, std::pointer_traits<pointer>::pointer_to(*reinterpret_cast<frame_unit*>(bytes)),
+               unit_count<UnitAlloc>(offset));
+         }
+      };
+   } // namespace detail
+
+   /**
+    * @brief Get the counters of the coroutine frame pool of the calling thread.
+    *
+    * @return frame_pool_stats The counters since the thread started.
+    */
+   inline frame_pool_stats this_thread_frame_pool_stats() { return detail::frame_pool::stats(); }
+} // namespace rdmapp
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <thread>
+
+#include "rdmapp/detail/event_count.h"
+
+namespace rdmapp::detail
+{
+   /**
+    * @brief A bounded lock-free multi-producer multi-consumer ring.
+    *
+    * Each cell carries a sequence number that tells producers and consumers whose turn it is, so the fast path is a
+    * single CAS on the head or tail index. Consumers spin for a short while before parking on an event_count.
+    *
+    * @tparam T The element type. It should be cheap to copy.
+    */
+   template <class T>
+   struct mpmc_queue
+   {
+      struct queue_closed_error
+      {};
+
+      // The number of times pop() polls the ring before parking.
+      static constexpr int kSpinCount = 128;
+
+      /**
+       * @brief Construct a new mpmc queue.
+       *
+       * @param capacity The capacity of the ring. It will be rounded up to a power of two.
+       * @param not_empty (Optional) An external event count to notify on pushes, for consumers that wait on several
+       * sources at once and only use try_pop().
+       */
+      explicit mpmc_queue(size_t capacity = 4096, event_count* not_empty = nullptr)
+         : mask_(std::bit_ceil(std::max<size_t>(capacity, 2)) - 1),
+           cells_(std::make_unique<cell[]>(mask_ + 1)),
+           not_empty_(not_empty ? *not_empty : own_not_empty_)
+      {
+         for (size_t i = 0; i <= mask_; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+         }
+      }
+
+      bool try_push(const T& item)
+      {
+         auto pos = enqueue_pos_.load(std::memory_order_relaxed);
+         while (true) {
+            auto& c = cells_[pos & mask_];
+            auto seq = c.sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+               if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                  c.data = item;
+                  c.sequence.store(pos + 1, std::memory_order_release);
+                  return true;
+               }
+            }
+            else if (diff < 0) {
+               return false;
+            }
+            else {
+               pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+         }
+      }
+
+      bool try_pop(T& item)
+      {
+         auto pos = dequeue_pos_.load(std::memory_order_relaxed);
+         while (true) {
+            auto& c = cells_[pos & mask_];
+            auto seq = c.sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+               if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                  item = c.data;
+                  c.sequence.store(pos + mask_ + 1, std::memory_order_release);
+                  return true;
+               }
+            }
+            else if (diff < 0) {
+               return false;
+            }
+            else {
+               pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+         }
+      }
+
+      /**
+       * @brief Push an item, waiting for space if the ring is full.
+       *
+       * @param item The item to push.
+       * @throws queue_closed_error If the queue has been closed.
+       */
+      void push(const T& item)
+      {
+         push_one(item);
+         not_empty_.notify_one();
+      }
+
+      /**
+       * @brief Push a batch of items and wake consumers once.
+       *
+       * @param items The items to push.
+       * @throws queue_closed_error If the queue has been closed.
+       */
+      void push(std::span<const T> items)
+      {
+         for (auto& item : items) {
+            push_one(item);
+         }
+         if (items.size() == 1) {
+            not_empty_.notify_one();
+         }
+         else if (!items.empty()) {
+            not_empty_.notify_all();
+         }
+      }
+
+      /**
+       * @brief Pop an item, spinning briefly and then parking if the ring is empty.
+       *
+       * @return T The popped item.
+       * @throws queue_closed_error If the queue has been closed and drained.
+       */
+      T pop()
+      {
+         T item;
+         while (true) {
+            for (int i = 0; i < kSpinCount; ++i) {
+               if (try_pop(item)) {
+                  return item;
+               }
+               if (closed_.load(std::memory_order_seq_cst)) {
+                  return drain_or_throw();
+               }
+               cpu_relax();
+            }
+            auto epoch = not_empty_.prepare_wait();
+            if (try_pop(item)) {
+               not_empty_.cancel_wait();
+               return item;
+            }
+            if (closed_.load(std::memory_order_seq_cst)) {
+               not_empty_.cancel_wait();
+               return drain_or_throw();
+            }
+            not_empty_.wait(epoch);
+         }
+      }
+
+      // Whether the ring looks empty. The answer may be stale by the time it is used.
+      bool empty() const
+      {
+         return dequeue_pos_.load(std::memory_order_acquire) >= enqueue_pos_.load(std::memory_order_acquire);
+      }
+
+      bool closed() const { return closed_.load(std::memory_order_seq_cst); }
+
+      void close()
+      {
+         closed_.store(true, std::memory_order_seq_cst);
+         not_empty_.notify_all();
+      }
+
+     private:
+      struct alignas(64) cell
+      {
+         std::atomic<size_t> sequence;
+         T data;
+      };
+
+      void push_one(const T& item)
+      {
+         if (closed_.load(std::memory_order_relaxed)) [[unlikely]] {
+            throw queue_closed_error();
+         }
+         while (!try_push(item)) {
+            // The ring is full: make sure consumers are awake to drain it before backing off.
+            not_empty_.notify_all();
+            std::this_thread::yield();
+            if (closed_.load(std::memory_order_relaxed)) [[unlikely]] {
+               throw queue_closed_error();
+            }
+         }
+      }
+
+      T drain_or_throw()
+      {
+         T item;
+         if (try_pop(item)) {
+            return item;
+         }
+         throw queue_closed_error();
+      }
+
+      const size_t mask_;
+      std::unique_ptr<cell[]> cells_;
+      alignas(64) std::atomic<size_t> enqueue_pos_{};
+      alignas(64) std::atomic<size_t> dequeue_pos_{};
+      alignas(64) std::atomic<bool> closed_{};
+      event_count own_not_empty_{};
+      event_count& not_empty_;
+   };
+} // namespace rdmapp::detail
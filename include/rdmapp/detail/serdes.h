@@ -26,7 +26,7 @@ namespace rdmapp::detail
    void serialize(const T& value, It& it)
    {
       T nvalue = hton(value);
-      std::copy_n(reinterpret_cast<uint8_t*>(&nvalue), sizeof(T), it);
+      it = std::copy_n(reinterpret_cast<uint8_t*>(&nvalue), sizeof(T), it);
    }
 
    template <std::integral T, class It>
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <coroutine>
+
+#include "rdmapp/executor.h"
+
+namespace rdmapp
+{
+   namespace detail
+   {
+      // A coroutine suspended on a synchronization primitive. It lives in the awaiter, so in the coroutine frame.
+      struct async_waiter
+      {
+         std::coroutine_handle<> h_;
+         async_waiter* next_{};
+      };
+
+      // An intrusive FIFO of waiters. Guarded by the lock of the primitive that owns it.
+      class waiter_queue
+      {
+         async_waiter* head_{};
+         async_waiter* tail_{};
+
+        public:
+         bool empty() const { return head_ == nullptr; }
+
+         void push_back(async_waiter& waiter)
+         {
+            waiter.next_ = nullptr;
+            if (tail_ != nullptr) {
+               tail_->next_ = &waiter;
+            }
+            else {
+               head_ = &waiter;
+            }
+            tail_ = &waiter;
+         }
+
+         async_waiter* pop_front()
+         {
+            auto waiter = head_;
+            if (waiter != nullptr) {
+               head_ = waiter->next_;
+               if (head_ == nullptr) {
+                  tail_ = nullptr;
+               }
+               waiter->next_ = nullptr;
+            }
+            return waiter;
+         }
+
+         // Take every waiter, leaving the queue empty. The result is linked through next_.
+         async_waiter* take_all()
+         {
+            auto waiters = head_;
+            head_ = tail_ = nullptr;
+            return waiters;
+         }
+      };
+
+      // Resume a waiter on the executor if there is one, or on the calling thread otherwise.
+      inline void resume_waiter(executor* exec, std::coroutine_handle<> h)
+      {
+         if (exec != nullptr) {
+            exec->post(h);
+         }
+         else {
+            h.resume();
+         }
+      }
+   } // namespace detail
+} // namespace rdmapp
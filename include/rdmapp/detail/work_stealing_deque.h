@@ -0,0 +1,108 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <type_traits>
+
+namespace rdmapp::detail
+{
+   /**
+    * @brief A bounded Chase-Lev work-stealing deque.
+    *
+    * The owning thread pushes and pops at the bottom (LIFO, for locality), while other threads steal from the top
+    * (FIFO). Only the owner may call push() and pop().
+    *
+    * @tparam T The element type. It must be trivially copyable, e.g. a coroutine handle.
+    */
+   template <class T>
+   struct work_stealing_deque
+   {
+      static_assert(std::is_trivially_copyable_v<T>);
+
+      /**
+       * @brief Construct a new work stealing deque.
+       *
+       * @param capacity The capacity of the deque. It will be rounded up to a power of two.
+       */
+      explicit work_stealing_deque(size_t capacity = 256)
+         : mask_(std::bit_ceil(std::max<size_t>(capacity, 2)) - 1),
+           buffer_(std::make_unique<std::atomic<T>[]>(mask_ + 1))
+      {}
+
+      /**
+       * @brief Push an item at the bottom. Owner only.
+       *
+       * @param item The item to push.
+       * @return true If the item was pushed.
+       * @return false If the deque is full.
+       */
+      bool push(T item)
+      {
+         auto b = bottom_.load(std::memory_order_relaxed);
+         auto t = top_.load(std::memory_order_acquire);
+         if (b - t > static_cast<int64_t>(mask_)) {
+            return false;
+         }
+         buffer_[b & mask_].store(item, std::memory_order_relaxed);
+         std::atomic_thread_fence(std::memory_order_release);
+         bottom_.store(b + 1, std::memory_order_relaxed);
+         return true;
+      }
+
+      // Pop the most recently pushed item. Owner only.
+      std::optional<T> pop()
+      {
+         auto b = bottom_.load(std::memory_order_relaxed) - 1;
+         bottom_.store(b, std::memory_order_relaxed);
+         std::atomic_thread_fence(std::memory_order_seq_cst);
+         auto t = top_.load(std::memory_order_relaxed);
+         if (t > b) {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return std::nullopt;
+         }
+         auto item = buffer_[b & mask_].load(std::memory_order_relaxed);
+         if (t == b) {
+            // Last item: race against thieves for it.
+            bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            if (!won) {
+               return std::nullopt;
+            }
+         }
+         return item;
+      }
+
+      // Steal the least recently pushed item. Safe to call from any thread.
+      std::optional<T> steal()
+      {
+         auto t = top_.load(std::memory_order_acquire);
+         std::atomic_thread_fence(std::memory_order_seq_cst);
+         auto b = bottom_.load(std::memory_order_acquire);
+         if (t >= b) {
+            return std::nullopt;
+         }
+         auto item = buffer_[t & mask_].load(std::memory_order_relaxed);
+         if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return std::nullopt;
+         }
+         return item;
+      }
+
+      // Whether the deque looks empty. The answer may be stale by the time it is used.
+      bool empty() const
+      {
+         return top_.load(std::memory_order_acquire) >= bottom_.load(std::memory_order_acquire);
+      }
+
+     private:
+      const size_t mask_;
+      std::unique_ptr<std::atomic<T>[]> buffer_;
+      alignas(64) std::atomic<int64_t> top_{};
+      alignas(64) std::atomic<int64_t> bottom_{};
+   };
+} // namespace rdmapp::detail
@@ -2,6 +2,9 @@
 
 #include <infiniband/verbs.h>
 
+#include <algorithm>
+#include <cstdint>
+
 #include "rdmapp/detail/util.h"
 
 namespace rdmapp
@@ -50,13 +53,22 @@ namespace rdmapp
    // Infiniband device.
    struct device final
    {
+      // Pick the GID index automatically, see select_gid().
+      static constexpr int kAutoGidIndex = -1;
+
       ibv_device* device_ptr{};
       uint16_t port_num{};
       ibv_context* ctx{};
       ibv_port_attr port_attr{};
       ibv_device_attr_ex attr_ex{};
+      // The local GID used in the global route header, required on RoCE where there are no LIDs.
+      int gid_index{-1};
+      ibv_gid gid{};
+      // Written to the global route header of connections that use one.
+      uint8_t hop_limit{64};
+      uint8_t traffic_class{0};
 
-      void open_device(ibv_device* target, uint16_t port_num_in)
+      void open_device(ibv_device* target, uint16_t port_num_in, int gid_index_in)
       {
          device_ptr = target;
          port_num = port_num_in;
@@ -65,28 +77,73 @@ namespace rdmapp
          check_rc(::ibv_query_port(ctx, port_num, &port_attr), "failed to query port");
          ibv_query_device_ex_input query{};
          check_rc(::ibv_query_device_ex(ctx, &query, &attr_ex), "failed to query extended attributes");
+         if (gid_index_in == kAutoGidIndex) {
+            select_gid();
+         }
+         else {
+            check_rc(::ibv_query_gid(ctx, port_num, gid_index_in, &gid), "failed to query gid");
+            gid_index = gid_index_in;
+         }
       }
 
-      device(const std::string& device_name, uint16_t port_num = 1)
+      // Prefer a RoCE v2 GID holding an IPv4-mapped address, which is routable and what rxe exposes for an IPv4
+      // interface, then any RoCE v2 GID, then the first valid entry.
+      void select_gid()
+      {
+         int fallback = -1;
+         int roce_v2 = -1;
+         for (int i = 0; i < port_attr.gid_tbl_len; ++i) {
+            ibv_gid_entry entry{};
+            if (::ibv_query_gid_ex(ctx, port_num, i, &entry, 0) != 0) {
+               continue; // Unpopulated entry.
+            }
+            if (fallback < 0) {
+               fallback = i;
+            }
+            if (entry.gid_type != IBV_GID_TYPE_ROCE_V2) {
+               continue;
+            }
+            if (roce_v2 < 0) {
+               roce_v2 = i;
+            }
+            auto raw = entry.gid.raw;
+            bool ipv4_mapped = std::all_of(raw, raw + 10, [](uint8_t b) { return b == 0; }) && raw[10] == 0xff &&
+                               raw[11] == 0xff;
+            if (ipv4_mapped) {
+               gid_index = i;
+               gid = entry.gid;
+               return;
+            }
+         }
+         gid_index = roce_v2 >= 0 ? roce_v2 : (fallback >= 0 ? fallback : 0);
+         if (::ibv_query_gid(ctx, port_num, gid_index, &gid) != 0) {
+            if (is_roce()) {
+               format_throw("no gid configured on port {} of {}", port_num, ::ibv_get_device_name(device_ptr));
+            }
+            gid_index = -1; // InfiniBand routes by LID without one.
+         }
+      }
+
+      device(const std::string& device_name, uint16_t port_num = 1, int gid_index = kAutoGidIndex)
       {
          auto list = device_list();
          for (auto target : list.devices) {
             if (::ibv_get_device_name(target) == device_name) {
-               open_device(target, port_num);
+               open_device(target, port_num, gid_index);
                return;
             }
          }
          format_throw("no device named {} found", device_name);
       }
 
-      device(uint16_t device_num, uint16_t port_num = 1)
+      device(uint16_t device_num, uint16_t port_num = 1, int gid_index = kAutoGidIndex)
       {
          auto list = device_list();
          auto devices = list.devices;
          if (device_num >= devices.size()) {
             format_throw("requested device number {} out of range, {} available", device_num, devices.size());
          }
-         open_device(devices[device_num], port_num);
+         open_device(devices[device_num], port_num, gid_index);
       }
 
       // Get the lid of the device.
@@ -95,6 +152,9 @@ namespace rdmapp
       // fabric and plays a crucial role in routing data packets to their destinations.
       uint16_t lid() const { return port_attr.lid; }
 
+      // Whether the port runs RDMA over Converged Ethernet, where connections are addressed by GID instead of LID.
+      bool is_roce() const { return port_attr.link_layer == IBV_LINK_LAYER_ETHERNET; }
+
       bool is_fetch_and_add_supported() const { return attr_ex.orig_attr.atomic_cap != IBV_ATOMIC_NONE; }
 
       bool is_compare_and_swap_supported() const { return attr_ex.orig_attr.atomic_cap != IBV_ATOMIC_NONE; }
@@ -12,6 +12,24 @@ namespace rdmapp
 {
    constexpr size_t error_string_buffer_size = 1024;
 
+   // Thrown by an operation whose deadline passed before it completed.
+   struct timeout_error : public std::runtime_error
+   {
+      using std::runtime_error::runtime_error;
+   };
+
+   // Thrown by an operation whose cancellation token was cancelled before it completed.
+   struct operation_cancelled : public std::runtime_error
+   {
+      using std::runtime_error::runtime_error;
+   };
+
+   // Thrown by a send on a closed async_channel.
+   struct channel_closed_error : public std::runtime_error
+   {
+      using std::runtime_error::runtime_error;
+   };
+
    static inline void throw_with(const char* message) { throw std::runtime_error(message); }
 
    template <class... Args>
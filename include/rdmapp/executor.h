@@ -2,58 +2,347 @@
 
 #include <infiniband/verbs.h>
 
+#include <coroutine>
+#include <cstdint>
 #include <functional>
+#include <memory>
+#include <span>
 #include <thread>
+#include <vector>
 
-#include "rdmapp/detail/blocking_queue.h"
+#include "rdmapp/completion_queue.h"
 #include "rdmapp/detail/debug.h"
+#include "rdmapp/detail/event_count.h"
+#include "rdmapp/detail/mpmc_queue.h"
 #include "rdmapp/detail/util.h"
+#include "rdmapp/detail/work_stealing_deque.h"
 
 namespace rdmapp
 {
-   // This class is used to execute callbacks of completion entries.
+   /**
+    * @brief An intrusive completion record. Its address is carried in the wr_id of a work request, and the executor
+    * calls its complete function once the corresponding completion entry arrives. Records are owned by whoever posted
+    * the work request, so dispatching a completion does not allocate.
+    */
+   struct completion_record
+   {
+      using complete_fn = void (*)(completion_record* self, const ibv_wc& wc);
+      complete_fn complete{}; // Called with the completion entry of the work request.
+      completion_timestamp timestamp_{}; // Filled in by the poller if the CQ reports hardware timestamps.
+
+      // The wr_id to post with the work request.
+      uint64_t wr_id() { return reinterpret_cast<uint64_t>(this); }
+
+      static completion_record* from_wr_id(uint64_t wr_id) { return reinterpret_cast<completion_record*>(wr_id); }
+   };
+
+   // A completion record that stores the completion entry and resumes a suspended coroutine.
+   struct resuming_completion : public completion_record
+   {
+      std::coroutine_handle<> h_{}; // The coroutine to resume.
+      ibv_wc wc_{}; // The completion entry, valid after resumption.
+
+      resuming_completion() : completion_record{&resuming_completion::resume} {}
+
+      static void resume(completion_record* self, const ibv_wc& wc)
+      {
+         auto record = static_cast<resuming_completion*>(self);
+         record->wc_ = wc;
+         record->h_.resume();
+      }
+   };
+
+   struct executor_config
+   {
+      size_t n_worker_threads = 0; // The number of worker threads, 0 means std::thread::hardware_concurrency().
+      size_t queue_capacity = 4096; // The capacity of the shared completion and injection rings.
+      size_t local_capacity = 256; // The capacity of each worker's local deque.
+      // Deliver the completions of each queue pair in CQ order, one at a time. Every queue pair is mapped to a serial
+      // lane owned by one worker, so completions of different queue pairs still run in parallel.
+      bool ordered = false;
+   };
+
+   /**
+    * @brief This class is used to execute callbacks of completion entries.
+    *
+    * Completion entries from pollers go through a shared lock-free ring. Coroutines scheduled from a worker thread
+    * (see post() and schedule()) go to that worker's local deque, and idle workers steal from the others, so a
+    * long-running handler does not hold up the work queued behind it.
+    *
+    * In ordered mode, completion entries are instead routed by QP number to per-worker lanes that are never stolen
+    * from, so coroutines awaiting operations on the same queue pair resume in CQ order without locking.
+    */
    struct executor
    {
+      using config = executor_config;
+
      private:
-      using work_queue_t = detail::blocking_queue<ibv_wc>;
-      std::vector<std::thread> workers;
+      using work_queue_t = detail::mpmc_queue<ibv_wc>;
+      using handle_queue_t = detail::mpmc_queue<std::coroutine_handle<>>;
+
+      struct worker
+      {
+         executor* exec;
+         size_t id;
+         detail::work_stealing_deque<std::coroutine_handle<>> deque;
+         uint64_t rng; // State of the xorshift generator used to pick victims.
+         std::unique_ptr<work_queue_t> lane; // Completions of the queue pairs mapped to this worker, if ordered.
+      };
+
+      // How often a worker looks at the shared rings before its own deque, so local work cannot starve them.
+      static constexpr uint32_t kGlobalCheckInterval = 61;
+      static constexpr int kSpinCount = 64;
+
+      static inline thread_local worker* current_worker_ = nullptr;
+
+      detail::event_count idle_{};
       work_queue_t work_queue;
+      handle_queue_t inject_queue;
+      bool ordered_{};
+      std::vector<std::unique_ptr<worker>> states;
+      std::vector<std::thread> workers;
 
-      void worker_fn(size_t worker_id)
+      bool run_global(worker& self)
       {
-         try {
-            while (true) {
-               auto wc = work_queue.pop();
-               auto cb = reinterpret_cast<callback_ptr>(wc.wr_id);
-               (*cb)(wc);
-               destroy_callback(cb);
+         ibv_wc wc;
+         if (self.lane && self.lane->try_pop(wc)) {
+            dispatch(wc);
+            return true;
+         }
+         if (work_queue.try_pop(wc)) {
+            dispatch(wc);
+            return true;
+         }
+         std::coroutine_handle<> h;
+         if (inject_queue.try_pop(h)) {
+            h.resume();
+            return true;
+         }
+         return false;
+      }
+
+      bool run_stolen(worker& self)
+      {
+         auto n = states.size();
+         self.rng ^= self.rng << 13;
+         self.rng ^= self.rng >> 7;
+         self.rng ^= self.rng << 17;
+         auto start = self.rng % n;
+         for (size_t i = 0; i < n; ++i) {
+            auto& victim = *states[(start + i) % n];
+            if (&victim == &self) {
+               continue;
+            }
+            if (auto h = victim.deque.steal()) {
+               h->resume();
+               return true;
             }
          }
-         catch (work_queue_t::queue_closed_error&) {
-            RDMAPP_LOG_TRACE("executor worker %lu exited", worker_id);
+         return false;
+      }
+
+      bool run_one(worker& self, uint32_t tick)
+      {
+         if (tick % kGlobalCheckInterval == 0 && run_global(self)) {
+            return true;
+         }
+         if (auto h = self.deque.pop()) {
+            h->resume();
+            return true;
+         }
+         return run_global(self) || run_stolen(self);
+      }
+
+      bool has_work(const worker& self) const
+      {
+         if (self.lane && !self.lane->empty()) {
+            return true;
+         }
+         if (!work_queue.empty() || !inject_queue.empty()) {
+            return true;
+         }
+         for (auto& state : states) {
+            if (!state->deque.empty()) {
+               return true;
+            }
+         }
+         return false;
+      }
+
+      // Route completion entries to the lanes of their queue pairs, waking the workers once.
+      void push_lanes(std::span<const ibv_wc> wcs)
+      {
+         for (auto& wc : wcs) {
+            auto& lane = *states[wc.qp_num % states.size()]->lane;
+            while (!lane.try_push(wc)) {
+               if (work_queue.closed()) [[unlikely]] {
+                  throw queue_closed_error();
+               }
+               idle_.notify_all();
+               std::this_thread::yield();
+            }
+         }
+         // The lane owner may be any of the parked workers.
+         idle_.notify_all();
+      }
+
+      void worker_fn(worker& self)
+      {
+         current_worker_ = &self;
+         uint32_t tick = 0;
+         while (true) {
+            bool ran = false;
+            for (int i = 0; i < kSpinCount && !ran; ++i) {
+               ran = run_one(self, ++tick);
+               if (!ran) {
+                  detail::cpu_relax();
+               }
+            }
+            if (ran) {
+               continue;
+            }
+            auto epoch = idle_.prepare_wait();
+            if (has_work(self)) {
+               idle_.cancel_wait();
+               continue;
+            }
+            if (work_queue.closed()) {
+               idle_.cancel_wait();
+               break;
+            }
+            idle_.wait(epoch);
          }
+         current_worker_ = nullptr;
+         RDMAPP_LOG_TRACE("executor worker %lu exited", self.id);
       }
 
      public:
       using queue_closed_error = work_queue_t::queue_closed_error;
+
       using callback_fn = std::function<void(const ibv_wc& wc)>;
-      using callback_ptr = callback_fn*;
 
-      executor(size_t n_worker_threads = 4)
+      // A heap-allocated completion record wrapping an arbitrary callback.
+      struct callback_record : public completion_record
       {
+         callback_fn fn;
+      };
+      using callback_ptr = callback_record*;
+
+      /**
+       * @brief Construct a new executor object.
+       *
+       * @param cfg The executor configuration.
+       */
+      executor(config cfg = {})
+         : work_queue(cfg.queue_capacity, &idle_), inject_queue(cfg.queue_capacity, &idle_), ordered_(cfg.ordered)
+      {
+         auto n_worker_threads = cfg.n_worker_threads;
+         if (n_worker_threads == 0) {
+            n_worker_threads = std::max(1u, std::thread::hardware_concurrency());
+         }
          for (size_t i = 0; i < n_worker_threads; ++i) {
-            workers.emplace_back(&executor::worker_fn, this, i);
+            states.emplace_back(
+               new worker{this, i, detail::work_stealing_deque<std::coroutine_handle<>>(cfg.local_capacity), i + 1,
+                          ordered_ ? std::make_unique<work_queue_t>(cfg.queue_capacity, &idle_) : nullptr});
+         }
+         for (auto& state : states) {
+            workers.emplace_back(&executor::worker_fn, this, std::ref(*state));
          }
       }
 
+      /**
+       * @brief Construct a new executor object.
+       *
+       * @param n_worker_threads The number of worker threads.
+       * @param queue_capacity The capacity of the lock-free work queue shared by the workers.
+       */
+      executor(size_t n_worker_threads, size_t queue_capacity = 4096)
+         : executor(config{.n_worker_threads = n_worker_threads, .queue_capacity = queue_capacity})
+      {}
+
       /**
        * @brief Process a completion entry.
        *
        * @param wc The completion entry to process.
        */
-      void process_wc(const ibv_wc& wc) { work_queue.push(wc); }
+      void process_wc(const ibv_wc& wc)
+      {
+         if (ordered_) {
+            push_lanes(std::span<const ibv_wc>(&wc, 1));
+            return;
+         }
+         work_queue.push(wc);
+      }
 
-      void shutdown() { work_queue.close(); }
+      /**
+       * @brief Process a batch of completion entries, waking the workers once.
+       *
+       * @param wcs The completion entries to process.
+       */
+      void process_wc(std::span<const ibv_wc> wcs)
+      {
+         if (ordered_) {
+            push_lanes(wcs);
+            return;
+         }
+         work_queue.push(wcs);
+      }
+
+      /**
+       * @brief Run the completion record of a completion entry on the calling
+       * thread.
+       *
+       * @param wc The completion entry.
+       */
+      static void dispatch(const ibv_wc& wc)
+      {
+         auto record = completion_record::from_wr_id(wc.wr_id);
+         record->complete(record, wc);
+      }
+
+      /**
+       * @brief Schedule a coroutine to be resumed by a worker. When called from
+       * one of this executor's workers, it goes to that worker's local deque,
+       * where it may be stolen by idle workers.
+       *
+       * @param h The coroutine to resume.
+       */
+      void post(std::coroutine_handle<> h)
+      {
+         auto self = current_worker_;
+         if (self && self->exec == this && self->deque.push(h)) {
+            idle_.notify_one();
+            return;
+         }
+         inject_queue.push(h);
+      }
+
+      /**
+       * @brief Reschedule the awaiting coroutine on this executor, yielding the
+       * current worker to other work.
+       *
+       * @return auto An awaitable.
+       */
+      auto schedule()
+      {
+         struct awaitable
+         {
+            executor* exec;
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> h) { exec->post(h); }
+            void await_resume() const noexcept {}
+         };
+         return awaitable{this};
+      }
+
+      // The number of worker threads.
+      size_t size() const { return states.size(); }
+
+      void shutdown()
+      {
+         work_queue.close();
+         inject_queue.close();
+      }
 
       ~executor()
       {
@@ -67,6 +356,8 @@ namespace rdmapp
        * @brief Make a callback function that will be called when a completion entry
        * is processed. The callback function will be called in the executor's
        * thread. The lifetime of this pointer is controlled by the executor.
+       * Post it with cb->wr_id(). Prefer embedding a completion_record in the
+       * operation state where possible, as this path allocates.
        * @tparam T The type of the callback function.
        * @param cb The callback function.
        * @return callback_ptr The callback function pointer.
@@ -74,10 +365,18 @@ namespace rdmapp
       template <class T>
       static callback_ptr make_callback(const T& cb)
       {
-         return new executor::callback_fn(cb);
+         return new callback_record{{&executor::run_callback}, callback_fn(cb)};
       }
 
       static void destroy_callback(callback_ptr cb) { delete cb; }
+
+     private:
+      static void run_callback(completion_record* self, const ibv_wc& wc)
+      {
+         auto cb = static_cast<callback_ptr>(self);
+         cb->fn(wc);
+         destroy_callback(cb);
+      }
    };
 
 } // namespace rdmapp
\ No newline at end of file
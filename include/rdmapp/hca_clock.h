@@ -0,0 +1,98 @@
+#pragma once
+
+#include <infiniband/verbs.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include "rdmapp/completion_queue.h"
+#include "rdmapp/device.h"
+#include "rdmapp/detail/util.h"
+
+namespace rdmapp
+{
+   /**
+    * @brief Converts raw HCA clock cycles reported in completion timestamps into durations and system time. The
+    * mapping to system time is anchored by sampling the HCA clock with ibv_query_rt_values_ex, call sync()
+    * periodically to bound drift between the two clocks.
+    */
+   struct hca_clock final
+   {
+      std::shared_ptr<rdmapp::device> device{}; // The device whose clock to convert.
+      uint64_t khz{}; // The HCA core clock frequency in kHz.
+      uint64_t mask{}; // The valid bits of a completion timestamp.
+      uint64_t ref_cycles{}; // The HCA clock at the last sync.
+      std::chrono::system_clock::time_point ref_time{}; // The system clock at the last sync.
+
+      hca_clock(std::shared_ptr<rdmapp::device> device) : device(device)
+      {
+         check_ptr(device, "device pointer null");
+         khz = device->attr_ex.hca_core_clock;
+         mask = device->attr_ex.completion_timestamp_mask;
+         if (khz == 0) {
+            throw std::runtime_error("device does not report its hca core clock");
+         }
+         if (mask == 0) {
+            mask = ~uint64_t(0);
+         }
+         sync();
+      }
+
+      // Sample the HCA clock and the system clock together.
+      void sync()
+      {
+         ibv_values_ex values{};
+         values.comp_mask = IBV_VALUES_MASK_RAW_CLOCK;
+         auto before = std::chrono::system_clock::now();
+         check_rc(::ibv_query_rt_values_ex(device->ctx, &values), "failed to query hca clock");
+         auto after = std::chrono::system_clock::now();
+         ref_cycles = uint64_t(values.raw_clock.tv_sec) * 1'000'000'000 + uint64_t(values.raw_clock.tv_nsec);
+         ref_time = before + (after - before) / 2;
+      }
+
+      /**
+       * @brief Convert a number of HCA clock cycles into a duration.
+       *
+       * @param cycles The number of cycles.
+       * @return std::chrono::nanoseconds The duration.
+       */
+      std::chrono::nanoseconds to_duration(uint64_t cycles) const
+      {
+         return std::chrono::nanoseconds((cycles / khz) * 1'000'000 + (cycles % khz) * 1'000'000 / khz);
+      }
+
+      /**
+       * @brief The time elapsed between two completion timestamps, accounting for wrap-around.
+       *
+       * @param from The earlier timestamp.
+       * @param to The later timestamp.
+       * @return std::chrono::nanoseconds The elapsed time.
+       */
+      std::chrono::nanoseconds elapsed(const completion_timestamp& from, const completion_timestamp& to) const
+      {
+         return to_duration((to.hca_cycles - from.hca_cycles) & mask);
+      }
+
+      /**
+       * @brief Map a completion timestamp onto the system clock.
+       *
+       * @param ts The completion timestamp.
+       * @return std::chrono::system_clock::time_point The corresponding system time.
+       */
+      std::chrono::system_clock::time_point to_system_time(const completion_timestamp& ts) const
+      {
+         if (ts.wallclock_ns) {
+            return std::chrono::system_clock::time_point(
+               std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(ts.wallclock_ns)));
+         }
+         auto delta = (ts.hca_cycles - ref_cycles) & mask;
+         if (delta > mask / 2) {
+            // The timestamp predates the last sync.
+            auto behind = std::chrono::duration_cast<std::chrono::system_clock::duration>(to_duration((ref_cycles - ts.hca_cycles) & mask));
+            return ref_time - behind;
+         }
+         return ref_time + std::chrono::duration_cast<std::chrono::system_clock::duration>(to_duration(delta));
+      }
+   };
+}
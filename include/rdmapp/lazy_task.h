@@ -0,0 +1,189 @@
+#pragma once
+
+#include <cassert>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <utility>
+#include <variant>
+
+#include "rdmapp/detail/frame_pool.h"
+
+namespace rdmapp
+{
+   namespace detail
+   {
+      // Signals a thread blocked in sync_wait(). It may be destroyed as soon as wait() returns.
+      class sync_wait_event
+      {
+         std::mutex mutex_;
+         std::condition_variable cv_;
+         bool set_{};
+
+        public:
+         void set()
+         {
+            std::lock_guard lock(mutex_);
+            set_ = true;
+            cv_.notify_one();
+         }
+
+         void wait()
+         {
+            std::unique_lock lock(mutex_);
+            cv_.wait(lock, [this]() { return set_; });
+         }
+      };
+
+      template <class T>
+      struct lazy_result
+      {
+         std::variant<std::monostate, T, std::exception_ptr> result_;
+
+         template <class U>
+         void return_value(U&& value)
+         {
+            result_.template emplace<1>(std::forward<U>(value));
+         }
+
+         void unhandled_exception() { result_.template emplace<2>(std::current_exception()); }
+
+         T get()
+         {
+            if (result_.index() == 2) {
+               std::rethrow_exception(std::get<2>(result_));
+            }
+            return std::move(std::get<1>(result_));
+         }
+      };
+
+      template <>
+      struct lazy_result<void>
+      {
+         std::exception_ptr exception_;
+
+         void return_void() {}
+
+         void unhandled_exception() { exception_ = std::current_exception(); }
+
+         void get()
+         {
+            if (exception_) {
+               std::rethrow_exception(exception_);
+            }
+         }
+      };
+   } // namespace detail
+
+   /**
+    * @brief A coroutine that only starts when it is awaited, and resumes its awaiter
+    * by symmetric transfer once it is done. The result or exception is kept in the
+    * coroutine frame, so creating and awaiting one costs the frame allocation and
+    * nothing else: no shared state, no locks. The frame is destroyed with the
+    * lazy_task object. Use sync_wait() to run one from a thread that is not a
+    * coroutine.
+    *
+    * @tparam T The type of the result.
+    */
+   template <class T = void>
+   struct [[nodiscard]] lazy_task
+   {
+      struct promise_type : public detail::lazy_result<T>, public detail::pooled_frame
+      {
+         std::coroutine_handle<> continuation_ = std::noop_coroutine();
+         detail::sync_wait_event* sync_event_{};
+
+         lazy_task get_return_object() { return lazy_task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+
+         std::suspend_always initial_suspend() noexcept { return {}; }
+
+         auto final_suspend() noexcept
+         {
+            struct awaiter
+            {
+               bool await_ready() noexcept { return false; }
+               std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+               {
+                  auto& promise = h.promise();
+                  auto continuation = promise.continuation_;
+                  if (promise.sync_event_ != nullptr) {
+                     // The waiting thread may destroy the frame right away, so it is not touched after this.
+                     promise.sync_event_->set();
+                  }
+                  return continuation;
+               }
+               void await_resume() noexcept {}
+            };
+            return awaiter{};
+         }
+      };
+
+      using coroutine_handle_type = std::coroutine_handle<promise_type>;
+
+      struct awaiter
+      {
+         coroutine_handle_type h_;
+         bool await_ready() const noexcept { return false; }
+         coroutine_handle_type await_suspend(std::coroutine_handle<> awaiting) noexcept
+         {
+            h_.promise().continuation_ = awaiting;
+            return h_;
+         }
+         T await_resume() { return h_.promise().get(); }
+      };
+
+      lazy_task(lazy_task&& other) noexcept : h_(std::exchange(other.h_, nullptr)) {}
+
+      lazy_task& operator=(lazy_task&& other) noexcept
+      {
+         if (this != &other) {
+            if (h_) {
+               h_.destroy();
+            }
+            h_ = std::exchange(other.h_, nullptr);
+         }
+         return *this;
+      }
+
+      ~lazy_task()
+      {
+         if (h_) {
+            h_.destroy();
+         }
+      }
+
+      awaiter operator co_await() const noexcept
+      {
+         assert(h_ && !h_.done());
+         return awaiter{h_};
+      }
+
+      coroutine_handle_type handle() const noexcept { return h_; }
+
+     private:
+      explicit lazy_task(coroutine_handle_type h) : h_(h) {}
+      coroutine_handle_type h_;
+   };
+
+   /**
+    * @brief Run a lazy task and block the calling thread until it is done. The
+    * task runs on the calling thread until it first suspends, and is then
+    * finished by whichever thread resumes it.
+    *
+    * @param task The task to run.
+    * @return T The result of the task. Its exception, if any, is rethrown.
+    */
+   template <class T>
+   T sync_wait(lazy_task<T> task)
+   {
+      auto h = task.handle();
+      assert(h && !h.done());
+      detail::sync_wait_event event;
+      h.promise().sync_event_ = &event;
+      h.resume();
+      event.wait();
+      return h.promise().get();
+   }
+
+} // namespace rdmapp
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rdmapp/async_semaphore.h"
+#include "rdmapp/completion_queue.h"
+#include "rdmapp/cq_poller.h"
+#include "rdmapp/detail/serdes.h"
+#include "rdmapp/detail/util.h"
+#include "rdmapp/device.h"
+#include "rdmapp/error.h"
+#include "rdmapp/executor.h"
+#include "rdmapp/lazy_task.h"
+#include "rdmapp/mr.h"
+#include "rdmapp/protected_domain.h"
+#include "rdmapp/queue_pair.h"
+
+namespace rdmapp
+{
+   // The port a rail is opened on.
+   struct rail_config
+   {
+      std::string device_name;
+      uint16_t port_num = 1;
+      int gid_index = device::kAutoGidIndex;
+   };
+
+   // One port of an HCA, with its own protection domain, completion queue and poller.
+   struct rail
+   {
+      std::shared_ptr<rdmapp::device> device;
+      std::shared_ptr<protected_domain> pd;
+      std::shared_ptr<completion_queue> cq;
+      std::shared_ptr<cq_poller> poller;
+   };
+
+   /**
+    * @brief A buffer registered on every rail of a multi_rail. The i-th memory region belongs to the protection domain
+    * of the i-th rail.
+    */
+   class multi_rail_mr
+   {
+      void* addr_;
+      size_t length_;
+      std::vector<std::shared_ptr<local_mr>> mrs_;
+
+     public:
+      multi_rail_mr(void* addr, size_t length, std::vector<std::shared_ptr<local_mr>> mrs)
+         : addr_(addr), length_(length), mrs_(std::move(mrs))
+      {}
+
+      void* addr() const { return addr_; }
+
+      size_t length() const { return length_; }
+
+      // The number of rails the buffer is registered on.
+      size_t rails() const { return mrs_.size(); }
+
+      // The memory region of the buffer on a rail.
+      const std::shared_ptr<local_mr>& on_rail(size_t rail) const { return mrs_[rail]; }
+
+      /**
+       * @brief Serialize the memory region handles to be sent to a remote peer: a 32-bit count followed by each
+       * handle as local_mr::serialize() would write it.
+       *
+       * @return std::vector<uint8_t> The serialized handles.
+       */
+      std::vector<uint8_t> serialize() const
+      {
+         std::vector<uint8_t> buffer;
+         auto it = std::back_inserter(buffer);
+         detail::serialize(static_cast<uint32_t>(mrs_.size()), it);
+         for (auto const& mr : mrs_) {
+            auto serialized = mr->serialize();
+            buffer.insert(buffer.end(), serialized.begin(), serialized.end());
+         }
+         return buffer;
+      }
+   };
+
+   // The handles of a remote multi_rail_mr, one per rail.
+   struct multi_rail_remote_mr
+   {
+      // The most rails a peer may send the handles of.
+      static constexpr uint32_t kMaxRails = 4096;
+
+      std::vector<remote_mr> mrs;
+
+      // The size of the serialized handles of a buffer registered on the given number of rails.
+      static constexpr size_t serialized_size(size_t rails)
+      {
+         return sizeof(uint32_t) + rails * remote_mr::kSerializedSize;
+      }
+
+      /**
+       * @brief Deserialize the handles written by multi_rail_mr::serialize().
+       *
+       * @tparam It The iterator type.
+       * @param it The iterator to deserialize from.
+       * @return multi_rail_remote_mr The deserialized handles.
+       */
+      template <class It>
+      static multi_rail_remote_mr deserialize(It it)
+      {
+         multi_rail_remote_mr remote;
+         uint32_t count;
+         detail::deserialize(it, count);
+         if (count > kMaxRails) [[unlikely]] {
+            throw_with("buffer registered on %u rails exceeds the limit of %u", count, kMaxRails);
+         }
+         remote.mrs.reserve(count);
+         for (uint32_t i = 0; i < count; ++i) {
+            remote.mrs.push_back(remote_mr::deserialize(it));
+            it += remote_mr::kSerializedSize;
+         }
+         return remote;
+      }
+   };
+
+   /**
+    * @brief Several ports, possibly of several HCAs, used together to go beyond the bandwidth of one. Each rail has
+    * its own device, protection domain, completion queue and poller; the pollers share one executor.
+    */
+   class multi_rail : public noncopyable
+   {
+      std::vector<rail> rails_;
+
+     public:
+      /**
+       * @brief Open the rails.
+       *
+       * @param configs The ports to open, one rail each.
+       * @param exec (Optional) The executor processing the completions of all rails. One is created if unset.
+       */
+      explicit multi_rail(const std::vector<rail_config>& configs, std::shared_ptr<executor> exec = nullptr);
+
+      size_t size() const { return rails_.size(); }
+
+      const rail& operator[](size_t i) const { return rails_[i]; }
+
+      /**
+       * @brief Register a buffer on every rail.
+       *
+       * @param buffer The address of the buffer.
+       * @param length The length of the buffer.
+       * @return multi_rail_mr The memory regions of the buffer.
+       */
+      multi_rail_mr reg_mr(void* buffer, size_t length);
+   };
+
+   struct striped_qp_config
+   {
+      size_t stripe_size = 1 << 20; // Transfers are split into chunks of at most this many bytes.
+      size_t max_outstanding = 32; // The number of chunks in flight on a rail, across all transfers.
+   };
+
+   /**
+    * @brief Queue Pairs to the same peer, one per rail, used as one: large writes and reads are split into chunks
+    * spread over the rails and awaited together.
+    *
+    * A rail takes the next chunk of a transfer only once it has a free slot, out of max_outstanding, so a rail that
+    * completes its chunks sooner takes more of them, and a slower or busier one fewer. The slots are shared by all
+    * transfers, which keeps the send queue of a rail from overflowing.
+    */
+   class striped_qp : public noncopyable
+   {
+      struct rail_state
+      {
+         std::shared_ptr<queue_pair> qp;
+         async_semaphore slots;
+
+         rail_state(std::shared_ptr<queue_pair> qp, size_t max_outstanding) : qp(std::move(qp)), slots(max_outstanding)
+         {}
+      };
+
+      std::vector<std::unique_ptr<rail_state>> rails_;
+      const striped_qp_config config_;
+
+      // Posts chunks of a transfer on a rail, one at a time, taking their offsets from next_offset until none is left.
+      lazy_task<void> transfer_lane(ibv_wr_opcode opcode, size_t rail, const multi_rail_remote_mr& remote,
+                                    const multi_rail_mr& local, std::atomic<size_t>& next_offset);
+
+      lazy_task<size_t> transfer(ibv_wr_opcode opcode, const multi_rail_remote_mr& remote, const multi_rail_mr& local);
+
+     public:
+      /**
+       * @brief Construct a new striped Queue Pair.
+       *
+       * @param qps The connected Queue Pairs, the i-th one created on the i-th rail of a multi_rail.
+       * @param config The chunking and load balancing parameters.
+       */
+      explicit striped_qp(std::vector<std::shared_ptr<queue_pair>> qps, striped_qp_config config = {});
+
+      size_t rails() const { return rails_.size(); }
+
+      // The Queue Pair of a rail, such as to exchange memory region handles over it.
+      const std::shared_ptr<queue_pair>& on_rail(size_t rail) const { return rails_[rail]->qp; }
+
+      /**
+       * @brief Write a local buffer to a remote one, striped across the rails.
+       *
+       * @param remote The handles of the remote buffer. It must be at least as large as the local one.
+       * @param local The local buffer, registered on the same rails, in the same order.
+       * @return lazy_task<size_t> A coroutine returning the number of bytes written, once every chunk completed. If
+       * chunks failed, the exception of the first of them is rethrown.
+       */
+      [[nodiscard]] lazy_task<size_t> write(const multi_rail_remote_mr& remote, const multi_rail_mr& local);
+
+      /**
+       * @brief Read a remote buffer to a local one, striped across the rails.
+       *
+       * @param remote The handles of the remote buffer. It must be at least as large as the local one.
+       * @param local The local buffer, registered on the same rails, in the same order.
+       * @return lazy_task<size_t> A coroutine returning the number of bytes read. See write().
+       */
+      [[nodiscard]] lazy_task<size_t> read(const multi_rail_remote_mr& remote, const multi_rail_mr& local);
+   };
+} // namespace rdmapp
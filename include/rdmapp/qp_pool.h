@@ -0,0 +1,113 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "rdmapp/completion_queue.h"
+#include "rdmapp/detail/util.h"
+#include "rdmapp/protected_domain.h"
+#include "rdmapp/queue_pair.h"
+#include "rdmapp/shared_receive_queue.h"
+
+namespace rdmapp
+{
+   struct qp_pool_config
+   {
+      size_t min_idle = 16; // The number of Queue Pairs kept ready in the INIT state.
+      size_t max_idle = 64; // Released Queue Pairs beyond this number are destroyed instead of reused.
+   };
+
+   struct qp_pool_stats
+   {
+      uint64_t hits; // Queue Pairs handed out from the pool.
+      uint64_t misses; // Queue Pairs created on the spot because the pool was empty.
+      uint64_t recycled; // Released Queue Pairs reset and put back into the pool.
+   };
+
+   /**
+    * @brief A pool of Queue Pairs sharing a protection domain, completion queues and an optional SRQ, created and
+    * moved to the INIT state ahead of time, so that setting up a connection only costs the RTR and RTS transitions.
+    *
+    * A background thread keeps min_idle Queue Pairs ready. Once the last reference to a Queue Pair handed out by
+    * acquire() is dropped, it goes back to that thread, which resets it to INIT and pools it again. The pool must be
+    * owned by a std::shared_ptr for Queue Pairs to be reused; Queue Pairs that outlive the pool are destroyed. If
+    * creating a Queue Pair fails, the thread retries after a delay that doubles up to a second.
+    *
+    * Idle Queue Pairs count against their completion queues like any other: each reserves its work requests with
+    * completion_queue::attach(), which may grow the CQs with ibv_resize_cq. With the default queue pair size, the
+    * default max_idle of 64 can reserve about 16k completion entries, across the send and recv CQs, for Queue Pairs
+    * nobody uses.
+    */
+   class qp_pool : public noncopyable, public std::enable_shared_from_this<qp_pool>
+   {
+      std::shared_ptr<protected_domain> pd_;
+      std::shared_ptr<completion_queue> recv_cq_;
+      std::shared_ptr<completion_queue> send_cq_;
+      std::shared_ptr<shared_receive_queue> srq_;
+      const qp_pool_config config_;
+
+      std::mutex mutex_;
+      std::condition_variable cv_;
+      std::vector<std::unique_ptr<queue_pair>> idle_; // In the INIT state.
+      std::vector<std::unique_ptr<queue_pair>> released_; // To be reset by the worker.
+      qp_pool_stats stats_{};
+      bool stopped_{};
+      std::thread worker_;
+
+      // The delays between attempts to create a Queue Pair after a failure.
+      static constexpr std::chrono::milliseconds kMinRetryDelay{10};
+      static constexpr std::chrono::milliseconds kMaxRetryDelay{1000};
+
+      std::unique_ptr<queue_pair> create();
+
+      void release(queue_pair* qp);
+
+      void worker();
+
+     public:
+      /**
+       * @brief Construct a new pool and start filling it.
+       *
+       * @param pd The protection domain of the Queue Pairs.
+       * @param recv_cq The completion queue of recv work completions.
+       * @param send_cq The completion queue of send work completions.
+       * @param srq (Optional) If set, all recv work requests will be posted to this SRQ.
+       * @param config The sizes of the pool.
+       */
+      qp_pool(std::shared_ptr<protected_domain> pd, std::shared_ptr<completion_queue> recv_cq,
+              std::shared_ptr<completion_queue> send_cq, std::shared_ptr<shared_receive_queue> srq = nullptr,
+              qp_pool_config config = {});
+
+      /**
+       * @brief Construct a new pool and start filling it.
+       *
+       * @param pd The protection domain of the Queue Pairs.
+       * @param cq The completion queue of both send and recv work completions.
+       * @param srq (Optional) If set, all recv work requests will be posted to this SRQ.
+       * @param config The sizes of the pool.
+       */
+      qp_pool(std::shared_ptr<protected_domain> pd, std::shared_ptr<completion_queue> cq,
+              std::shared_ptr<shared_receive_queue> srq = nullptr, qp_pool_config config = {});
+
+      /**
+       * @brief Take a Queue Pair in the INIT state, ready for rtr() and rts(). If the pool is empty, one is created on
+       * the calling thread.
+       *
+       * @return std::shared_ptr<queue_pair> The Queue Pair. It returns to the pool once the last reference is dropped.
+       */
+      std::shared_ptr<queue_pair> acquire();
+
+      // The number of Queue Pairs ready to be handed out.
+      size_t idle();
+
+      qp_pool_stats stats();
+
+      ~qp_pool();
+   };
+} // namespace rdmapp
@@ -2,17 +2,23 @@
 
 #include <infiniband/verbs.h>
 
+#include <atomic>
+#include <chrono>
 #include <exception>
 #include <iterator>
 #include <optional>
 #include <string_view>
 
+#include "rdmapp/cancellation.h"
 #include "rdmapp/completion_queue.h"
 #include "rdmapp/detail/serdes.h"
 #include "rdmapp/device.h"
+#include "rdmapp/error.h"
+#include "rdmapp/executor.h"
 #include "rdmapp/protected_domain.h"
 #include "rdmapp/shared_receive_queue.h"
 #include "rdmapp/task.h"
+#include "rdmapp/timer_wheel.h"
 
 namespace rdmapp
 {
@@ -20,11 +26,12 @@ namespace rdmapp
    {
       struct qp_header
       {
-         static constexpr size_t kSerializedSize = sizeof(uint16_t) + 3 * sizeof(uint32_t);
+         static constexpr size_t kSerializedSize = sizeof(uint16_t) + 3 * sizeof(uint32_t) + sizeof(ibv_gid);
          uint16_t lid;
          uint32_t qp_num;
          uint32_t sq_psn;
          uint32_t user_data_size;
+         ibv_gid gid; // All zero if the peer has no GID.
       } header;
 
       template <class It>
@@ -35,12 +42,173 @@ namespace rdmapp
          detail::deserialize(it, des_qp.header.qp_num);
          detail::deserialize(it, des_qp.header.sq_psn);
          detail::deserialize(it, des_qp.header.user_data_size);
+         std::copy_n(it, sizeof(ibv_gid), des_qp.header.gid.raw);
          return des_qp;
       }
 
       std::vector<uint8_t> user_data;
    };
 
+   // The result of an operation awaited with its hardware completion timestamp.
+   template <class T>
+   struct timestamped
+   {
+      T value;
+      completion_timestamp timestamp;
+   };
+
+   /**
+    * @brief Wraps a queue pair awaitable so that co_await also yields the hardware completion timestamp. The completion
+    * queue must be created with timestamps enabled, otherwise the timestamp is zero.
+    *
+    * @tparam Awaitable The wrapped awaitable.
+    */
+   template <class Awaitable>
+   struct timestamped_awaitable
+   {
+      Awaitable awaitable_;
+
+      bool await_ready() noexcept { return awaitable_.await_ready(); }
+      bool await_suspend(std::coroutine_handle<> h) noexcept { return awaitable_.await_suspend(h); }
+      auto await_resume()
+      {
+         using value_type = decltype(awaitable_.await_resume());
+         auto value = awaitable_.await_resume();
+         return timestamped<value_type>{std::move(value), awaitable_.timestamp()};
+      }
+   };
+
+   /**
+    * @brief Wraps a queue pair awaitable with a deadline, a cancellation token, or both. Work requests cannot be
+    * withdrawn once posted, so on timeout or cancellation the Queue Pair is moved to the error state: every outstanding
+    * work request on it is flushed, and this operation resumes through its completion as usual and throws
+    * timeout_error or operation_cancelled. The other operations on the Queue Pair fail with a flush error, and the
+    * Queue Pair has to be reconnected before it can be used again. An operation that completes successfully while the
+    * deadline fires still returns its result.
+    *
+    * @tparam Awaitable The wrapped awaitable.
+    */
+   template <class Awaitable>
+   class cancellable_awaitable : private timer_record, private cancellation_record
+   {
+      static constexpr int kPending = 0;
+      static constexpr int kTimedOut = 1;
+      static constexpr int kCancelled = 2;
+
+      Awaitable awaitable_;
+      timer_wheel* timers_{};
+      timer_wheel::clock::time_point deadline_{};
+      cancellation_token token_;
+      std::atomic<int> reason_{kPending};
+      bool posted_{};
+
+      static void on_timer(timer_record* self) { static_cast<cancellable_awaitable*>(self)->abort(kTimedOut); }
+
+      static void on_cancel(cancellation_record* self) { static_cast<cancellable_awaitable*>(self)->abort(kCancelled); }
+
+      // Runs on the thread advancing the timer wheel or cancelling the source.
+      void abort(int reason)
+      {
+         int expected = kPending;
+         if (reason_.compare_exchange_strong(expected, reason, std::memory_order_acq_rel)) {
+            awaitable_.qp().set_error();
+         }
+      }
+
+      [[noreturn]] void throw_aborted() const
+      {
+         if (reason_.load(std::memory_order_acquire) == kTimedOut) {
+            throw timeout_error("operation timed out");
+         }
+         throw operation_cancelled("operation cancelled");
+      }
+
+      void check_flushable() const
+      {
+         if (!awaitable_.flushable()) {
+            throw_with("operations posted to a shared receive queue cannot time out or be cancelled");
+         }
+      }
+
+     public:
+      explicit cancellable_awaitable(Awaitable&& awaitable)
+         : timer_record(&on_timer), cancellation_record(&on_cancel), awaitable_(std::move(awaitable))
+      {}
+
+      cancellable_awaitable(cancellable_awaitable&& other)
+         : timer_record(&on_timer), cancellation_record(&on_cancel), awaitable_(std::move(other.awaitable_)),
+           timers_(other.timers_), deadline_(other.deadline_), token_(std::move(other.token_))
+      {}
+
+      /**
+       * @brief Fail the operation with timeout_error if it has not completed by a deadline.
+       *
+       * @param timers The timer wheel to schedule the deadline on, such as that of the cq_poller.
+       * @param deadline The deadline.
+       */
+      cancellable_awaitable with_deadline(timer_wheel& timers, timer_wheel::clock::time_point deadline) &&
+      {
+         check_flushable();
+         timers_ = &timers;
+         deadline_ = deadline;
+         return std::move(*this);
+      }
+
+      // Fail the operation with timeout_error if it has not completed within a timeout from now.
+      cancellable_awaitable with_timeout(timer_wheel& timers, timer_wheel::clock::duration timeout) &&
+      {
+         return std::move(*this).with_deadline(timers, timer_wheel::clock::now() + timeout);
+      }
+
+      // Fail the operation with operation_cancelled if the token is cancelled before it completes.
+      cancellable_awaitable with_cancellation(cancellation_token token) &&
+      {
+         check_flushable();
+         token_ = std::move(token);
+         return std::move(*this);
+      }
+
+      bool await_ready() noexcept { return awaitable_.await_ready(); }
+
+      bool await_suspend(std::coroutine_handle<> h)
+      {
+         if (token_.cancelled()) {
+            reason_.store(kCancelled, std::memory_order_relaxed);
+            return false;
+         }
+         // Armed before posting: once posted, the operation may resume and destroy this on another thread.
+         if (timers_ != nullptr) {
+            timers_->schedule(*this, deadline_);
+         }
+         if (token_.can_be_cancelled() && !token_.register_callback(*this)) {
+            abort(kCancelled);
+         }
+         posted_ = true;
+         return awaitable_.await_suspend(h);
+      }
+
+      auto await_resume()
+      {
+         // Waits for a timer or callback that is running, so neither touches this once it returns.
+         if (timers_ != nullptr) {
+            timers_->cancel(*this);
+         }
+         token_.deregister_callback(*this);
+         if (reason_.load(std::memory_order_acquire) == kPending) {
+            return awaitable_.await_resume();
+         }
+         if (!posted_) {
+            throw_aborted();
+         }
+         try {
+            return awaitable_.await_resume();
+         }
+         catch (const std::runtime_error&) {
+            throw_aborted();
+         }
+      }
+   };
+
    struct queue_pair : public noncopyable, public std::enable_shared_from_this<queue_pair>
    {
      private:
@@ -48,6 +216,8 @@ namespace rdmapp
       ibv_qp* qp_{};
       ibv_srq* raw_srq_{};
       uint32_t sq_psn_{};
+      uint32_t max_send_wr_{128};
+      uint32_t max_recv_wr_{128};
       void (queue_pair::*post_recv_fn)(const ibv_recv_wr& recv_wr, ibv_recv_wr*& bad_recv_wr) const;
 
       std::shared_ptr<protected_domain> pd_;
@@ -55,6 +225,10 @@ namespace rdmapp
       std::shared_ptr<completion_queue> send_cq_;
       std::shared_ptr<shared_receive_queue> srq_;
       std::vector<uint8_t> user_data_;
+      std::optional<deserialized_qp::qp_header> remote_; // Set by rtr(), for recover().
+
+      // A send and a recv work request reserved for the markers posted by drain().
+      static constexpr uint32_t kDrainWrs = 1;
 
       // Creates a new Queue Pair. The Queue Pair will be in the RESET state.
       void create();
@@ -62,10 +236,17 @@ namespace rdmapp
       // Initializes the Queue Pair. The Queue Pair will be in the INIT state.
       void init();
 
+      // Transitions the Queue Pair to the RESET state and back to INIT, with a new send PSN.
+      void reinit();
+
       void destroy();
 
+      // Releases the completion entries accounted on the CQs in create().
+      void detach_cqs();
+
      public:
-      class send_awaitable
+      // The awaitable is its own completion record: its address is posted as the wr_id.
+      class send_awaitable : private resuming_completion
       {
          std::shared_ptr<queue_pair> qp_;
          std::shared_ptr<local_mr> local_mr_;
@@ -74,8 +255,9 @@ namespace rdmapp
          uint64_t compare_add_;
          uint64_t swap_;
          uint32_t imm_;
-         struct ibv_wc wc_;
          const enum ibv_wr_opcode opcode_;
+         size_t local_offset_{};
+         std::optional<uint32_t> local_length_; // Unset to transfer the whole local memory region.
 
         public:
          send_awaitable(std::shared_ptr<queue_pair> qp, void* buffer, size_t length, enum ibv_wr_opcode opcode);
@@ -96,21 +278,65 @@ namespace rdmapp
                         const remote_mr& remote_mr, uint64_t add);
          send_awaitable(std::shared_ptr<queue_pair> qp, std::shared_ptr<local_mr> local_mr, enum ibv_wr_opcode opcode,
                         const remote_mr& remote_mr, uint64_t compare, uint64_t swap);
+         send_awaitable(std::shared_ptr<queue_pair> qp, std::shared_ptr<local_mr> local_mr, size_t offset,
+                        uint32_t length, enum ibv_wr_opcode opcode, const remote_mr& remote_mr);
          bool await_ready() const noexcept;
          bool await_suspend(std::coroutine_handle<> h) noexcept;
          uint32_t await_resume() const;
+
+         // The hardware completion timestamp, valid after resumption.
+         const completion_timestamp& timestamp() const { return timestamp_; }
+
+         /**
+          * @brief Await the operation together with its hardware completion timestamp.
+          *
+          * @return timestamped_awaitable<send_awaitable> An awaitable returning timestamped<uint32_t>.
+          */
+         timestamped_awaitable<send_awaitable> with_timestamp() && { return {std::move(*this)}; }
+
+         /**
+          * @brief Await the operation with a deadline. See cancellable_awaitable.
+          *
+          * @param timers The timer wheel to schedule the deadline on, such as that of the cq_poller.
+          * @param deadline The deadline.
+          * @return cancellable_awaitable<send_awaitable> An awaitable throwing timeout_error once the deadline passes.
+          */
+         cancellable_awaitable<send_awaitable> with_deadline(timer_wheel& timers,
+                                                             timer_wheel::clock::time_point deadline) &&
+         {
+            return cancellable_awaitable<send_awaitable>(std::move(*this)).with_deadline(timers, deadline);
+         }
+
+         // Await the operation with a deadline a timeout from now. See cancellable_awaitable.
+         cancellable_awaitable<send_awaitable> with_timeout(timer_wheel& timers,
+                                                            timer_wheel::clock::duration timeout) &&
+         {
+            return cancellable_awaitable<send_awaitable>(std::move(*this)).with_timeout(timers, timeout);
+         }
+
+         // Await the operation until the token is cancelled. See cancellable_awaitable.
+         cancellable_awaitable<send_awaitable> with_cancellation(cancellation_token token) &&
+         {
+            return cancellable_awaitable<send_awaitable>(std::move(*this)).with_cancellation(std::move(token));
+         }
+
+         // The Queue Pair the operation is posted to.
+         queue_pair& qp() const { return *qp_; }
+
+         // Whether moving the Queue Pair to the error state flushes the operation.
+         bool flushable() const { return true; }
+
          constexpr bool is_rdma() const;
          constexpr bool is_atomic() const;
       };
 
-      struct recv_awaitable
+      // The awaitable is its own completion record: its address is posted as the wr_id.
+      struct recv_awaitable : private resuming_completion
       {
         private:
          std::shared_ptr<queue_pair> qp_;
          std::shared_ptr<local_mr> local_mr_;
          std::exception_ptr exception_;
-         struct ibv_wc wc_;
-         enum ibv_wr_opcode opcode_;
 
         public:
          recv_awaitable(std::shared_ptr<queue_pair> qp, std::shared_ptr<local_mr> local_mr);
@@ -118,6 +344,79 @@ namespace rdmapp
          bool await_ready() const noexcept;
          bool await_suspend(std::coroutine_handle<> h) noexcept;
          std::pair<uint32_t, std::optional<uint32_t>> await_resume() const;
+
+         // The hardware completion timestamp, valid after resumption.
+         const completion_timestamp& timestamp() const { return timestamp_; }
+
+         /**
+          * @brief Await the operation together with its hardware completion timestamp.
+          *
+          * @return timestamped_awaitable<recv_awaitable> An awaitable returning
+          * timestamped<std::pair<uint32_t, std::optional<uint32_t>>>.
+          */
+         timestamped_awaitable<recv_awaitable> with_timestamp() && { return {std::move(*this)}; }
+
+         /**
+          * @brief Await the operation with a deadline. See cancellable_awaitable.
+          *
+          * @param timers The timer wheel to schedule the deadline on, such as that of the cq_poller.
+          * @param deadline The deadline.
+          * @return cancellable_awaitable<recv_awaitable> An awaitable throwing timeout_error once the deadline passes.
+          */
+         cancellable_awaitable<recv_awaitable> with_deadline(timer_wheel& timers,
+                                                             timer_wheel::clock::time_point deadline) &&
+         {
+            return cancellable_awaitable<recv_awaitable>(std::move(*this)).with_deadline(timers, deadline);
+         }
+
+         // Await the operation with a deadline a timeout from now. See cancellable_awaitable.
+         cancellable_awaitable<recv_awaitable> with_timeout(timer_wheel& timers,
+                                                            timer_wheel::clock::duration timeout) &&
+         {
+            return cancellable_awaitable<recv_awaitable>(std::move(*this)).with_timeout(timers, timeout);
+         }
+
+         // Await the operation until the token is cancelled. See cancellable_awaitable.
+         cancellable_awaitable<recv_awaitable> with_cancellation(cancellation_token token) &&
+         {
+            return cancellable_awaitable<recv_awaitable>(std::move(*this)).with_cancellation(std::move(token));
+         }
+
+         // The Queue Pair the operation is posted to.
+         queue_pair& qp() const { return *qp_; }
+
+         // Whether moving the Queue Pair to the error state flushes the operation.
+         // Receives posted to a shared receive queue are not, since the SRQ outlives the Queue Pair.
+         bool flushable() const { return qp_->srq_ == nullptr; }
+      };
+
+      /**
+       * @brief The awaitable returned by drain(). It moves the Queue Pair to the error state and posts a marker work
+       * request behind the outstanding ones on the send queue, and on the receive queue unless an SRQ is used. Work
+       * requests are flushed in order, so once the markers are flushed, every earlier work request has been
+       * completed and its awaiter resumed.
+       */
+      class drain_awaitable
+      {
+         struct marker : public completion_record
+         {
+            drain_awaitable* self_;
+         };
+
+         std::shared_ptr<queue_pair> qp_;
+         marker send_marker_;
+         marker recv_marker_;
+         std::atomic<int> remaining_{};
+         std::coroutine_handle<> h_;
+         std::exception_ptr exception_;
+
+         static void on_flushed(completion_record* self, const ibv_wc& wc);
+
+        public:
+         explicit drain_awaitable(std::shared_ptr<queue_pair> qp);
+         bool await_ready() const noexcept;
+         bool await_suspend(std::coroutine_handle<> h) noexcept;
+         void await_resume() const;
       };
 
       /**
@@ -153,6 +452,21 @@ namespace rdmapp
       queue_pair(const uint16_t remote_lid, const uint32_t remote_qpn, const uint32_t remote_psn, std::shared_ptr<protected_domain> pd,
          std::shared_ptr<completion_queue> recv_cq, std::shared_ptr<completion_queue> send_cq, std::shared_ptr<shared_receive_queue> srq = nullptr);
 
+      /**
+       * @brief Construct a new qp object connected to a Queue Pair received in a
+       * handshake. Works on both InfiniBand and RoCE. Once constructed, the Queue
+       * Pair will be in the RTS state.
+       *
+       * @param remote The header of the remote Queue Pair.
+       * @param pd The protection domain of the new Queue Pair.
+       * @param recv_cq The completion queue of recv work completions.
+       * @param send_cq The completion queue of send work completions.
+       * @param srq (Optional) If set, all recv work requests will be posted to this
+       * SRQ.
+       */
+      queue_pair(const deserialized_qp::qp_header& remote, std::shared_ptr<protected_domain> pd,
+         std::shared_ptr<completion_queue> recv_cq, std::shared_ptr<completion_queue> send_cq, std::shared_ptr<shared_receive_queue> srq = nullptr);
+
       /**
        * @brief Construct a new qp object. The constructed Queue Pair will be in
        * INIT state.
@@ -304,6 +618,21 @@ namespace rdmapp
        */
       [[nodiscard]] send_awaitable write(const remote_mr& remote_mr, std::shared_ptr<local_mr> local_mr);
 
+      /**
+       * @brief This function writes part of a registered local memory region to
+       * remote.
+       *
+       * @param remote_mr Remote memory region handle, starting where the data
+       * goes.
+       * @param local_mr Registered local memory region, whose lifetime is
+       * controlled by a smart pointer.
+       * @param offset The offset of the data in the local memory region.
+       * @param length The length of the data.
+       * @return send_awaitable A coroutine returning length of the data written.
+       */
+      [[nodiscard]] send_awaitable write(const remote_mr& remote_mr, std::shared_ptr<local_mr> local_mr,
+                                         size_t offset, uint32_t length);
+
       /**
        * @brief This function writes a registered local memory region to remote with
        * an immediate value.
@@ -327,6 +656,21 @@ namespace rdmapp
        */
       [[nodiscard]] send_awaitable read(const remote_mr& remote_mr, std::shared_ptr<local_mr> local_mr);
 
+      /**
+       * @brief This function reads from remote to part of a registered local
+       * memory region.
+       *
+       * @param remote_mr Remote memory region handle, starting where the data
+       * comes from.
+       * @param local_mr Registered local memory region, whose lifetime is
+       * controlled by a smart pointer.
+       * @param offset The offset of the data in the local memory region.
+       * @param length The length of the data.
+       * @return send_awaitable A coroutine returning length of the data read.
+       */
+      [[nodiscard]] send_awaitable read(const remote_mr& remote_mr, std::shared_ptr<local_mr> local_mr, size_t offset,
+                                        uint32_t length);
+
       /**
        * @brief This function performs an atomic fetch-and-add operation on the
        * given remote memory region.
@@ -374,6 +718,16 @@ namespace rdmapp
        */
       std::vector<uint8_t> serialize() const;
 
+      /**
+       * @brief This function serializes the header of the Queue Pair, without the
+       * user data, so that it can be sent together with the user data in one
+       * write.
+       *
+       * @param buffer The buffer to write
+       * deserialized_qp::qp_header::kSerializedSize bytes to.
+       */
+      void serialize_header(uint8_t* buffer) const;
+
       /**
        * @brief This function provides access to the extra user data of the Queue
        * Pair.
@@ -381,6 +735,7 @@ namespace rdmapp
        * @return std::vector<uint8_t>& The extra user data.
        */
       std::vector<uint8_t>& user_data();
+      const std::vector<uint8_t>& user_data() const;
 
       /**
        * @brief This function provides access to the Protection Domain of the Queue
@@ -397,12 +752,81 @@ namespace rdmapp
        * @param remote_lid The remote LID.
        * @param remote_qpn The remote QPN.
        * @param remote_psn The remote PSN.
+       * @param remote_gid The remote GID. It is required on RoCE, or when the
+       * remote LID is 0, and ignored otherwise.
+       */
+      void rtr(uint16_t remote_lid, uint32_t remote_qpn, uint32_t remote_psn, const ibv_gid& remote_gid = {});
+
+      /**
+       * @brief This function transitions the Queue Pair to the RTR state.
+       *
+       * @param remote The header of the remote Queue Pair received in a handshake.
        */
-      void rtr(uint16_t remote_lid, uint32_t remote_qpn, uint32_t remote_psn);
+      void rtr(const deserialized_qp::qp_header& remote);
 
       // This function transitions the Queue Pair to the RTS state.
       void rts();
 
+      /**
+       * @brief This function transitions the Queue Pair to the RESET state and
+       * back to INIT, with a new send PSN, no user data and no remote, so that
+       * it can be connected again to any Queue Pair. Outstanding work requests are discarded without
+       * completions, so none may be awaited.
+       */
+      void reset();
+
+      /**
+       * @brief This function transitions the Queue Pair with attributes prepared
+       * elsewhere, such as by rdma_init_qp_attr().
+       *
+       * @param attr The attributes, including the target state.
+       * @param attr_mask The attributes to apply.
+       */
+      void modify(ibv_qp_attr& attr, int attr_mask);
+
+      // The number of the Queue Pair.
+      uint32_t qp_num() const;
+
+      /**
+       * @brief This function transitions the Queue Pair to the ERR state, so that
+       * all outstanding work requests complete with IBV_WC_WR_FLUSH_ERR. Unlike
+       * the other transitions, it does not throw, since it is called from timers
+       * and cancellation callbacks. Failures are logged.
+       */
+      void set_error();
+
+      /**
+       * @brief This function moves the Queue Pair to the error state and waits
+       * until every outstanding work request is flushed, so that all of their
+       * awaiters have been resumed, with IBV_WC_WR_FLUSH_ERR if they had not
+       * completed yet. It is the first step of recovering a Queue Pair that a
+       * work completion error moved to the error state.
+       *
+       * @return drain_awaitable An awaitable that returns once the Queue Pair is
+       * drained. Completions must be polled meanwhile, such as by a cq_poller.
+       */
+      [[nodiscard]] drain_awaitable drain();
+
+      /**
+       * @brief This function transitions a drained Queue Pair to the RESET state
+       * and back to INIT, with a new send PSN, keeping the remote parameters of
+       * the last rtr() and the user data. Send the returned PSN to the peer, which
+       * recovers its own Queue Pair the same way, and pass the PSN it answers to
+       * recover().
+       *
+       * @return uint32_t The new send PSN.
+       */
+      uint32_t prepare_recovery();
+
+      /**
+       * @brief This function reconnects a Queue Pair prepared by
+       * prepare_recovery() to the same remote Queue Pair, transitioning it to the
+       * RTR and RTS states without a new handshake.
+       *
+       * @param remote_psn The new send PSN of the remote Queue Pair.
+       */
+      void recover(uint32_t remote_psn);
+
      private:
       /**
        * @brief This function posts a recv request on the Queue Pair's own RQ.
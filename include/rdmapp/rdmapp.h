@@ -1,10 +1,22 @@
 #pragma once
 
+#include "rdmapp/async_channel.h"
+#include "rdmapp/async_mutex.h"
+#include "rdmapp/async_scope.h"
+#include "rdmapp/async_semaphore.h"
+#include "rdmapp/cancellation.h"
 #include "rdmapp/completion_queue.h"
 #include "rdmapp/cq_poller.h"
 #include "rdmapp/device.h"
 #include "rdmapp/error.h"
+#include "rdmapp/hca_clock.h"
+#include "rdmapp/lazy_task.h"
+#include "rdmapp/multi_rail.h"
 #include "rdmapp/protected_domain.h"
+#include "rdmapp/qp_pool.h"
 #include "rdmapp/queue_pair.h"
 #include "rdmapp/shared_receive_queue.h"
-#include "rdmapp/task.h"
\ No newline at end of file
+#include "rdmapp/task.h"
+#include "rdmapp/timer_wheel.h"
+#include "rdmapp/when_all.h"
+#include "rdmapp/when_any.h"
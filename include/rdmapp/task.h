@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <cassert>
 #include <coroutine>
 #include <exception>
@@ -7,6 +8,7 @@
 #include <future>
 
 #include "rdmapp/detail/debug.h"
+#include "rdmapp/detail/frame_pool.h"
 #include "rdmapp/detail/util.h"
 
 namespace rdmapp
@@ -26,34 +28,38 @@ namespace rdmapp
    };
 
    template <class T, class CoroutineHandle>
-   struct promise_base : public value_returner<T>
+   struct promise_base : public value_returner<T>, public detail::pooled_frame
    {
+      // Values of waiter_ other than a coroutine awaiting the task.
+      inline static void* const kDone = reinterpret_cast<void*>(1);
+      inline static void* const kDetached = reinterpret_cast<void*>(2);
+
       std::suspend_never initial_suspend() { return {}; }
       auto final_suspend() noexcept
       {
          struct awaiter
          {
-            std::coroutine_handle<> release_detached_;
             bool await_ready() noexcept { return false; }
             std::coroutine_handle<> await_suspend(CoroutineHandle suspended) noexcept
             {
-               if (suspended.promise().continuation_) {
-                  return suspended.promise().continuation_;
+               auto waiter = suspended.promise().waiter_.exchange(kDone, std::memory_order_acq_rel);
+               if (waiter == kDetached) {
+                  suspended.destroy();
+                  return std::noop_coroutine();
                }
-               else {
-                  if (release_detached_) {
-                     release_detached_.destroy();
-                  }
+               if (waiter == nullptr) {
                   return std::noop_coroutine();
                }
+               return std::coroutine_handle<>::from_address(waiter);
             }
             void await_resume() noexcept {}
          };
-         return awaiter{release_detached_};
+         return awaiter{};
       }
 
-      std::coroutine_handle<> continuation_;
-      std::coroutine_handle<> release_detached_;
+      // The coroutine awaiting the task, kDetached once nobody will, or kDone once the task has finished. The task
+      // may finish on another thread while it is being awaited or detached, so both sides swap it atomically.
+      std::atomic<void*> waiter_{};
    };
 
    template <class T>
@@ -65,7 +71,6 @@ namespace rdmapp
          void unhandled_exception() { this->promise.set_exception(std::current_exception()); }
          promise_type() : future_(this->promise.get_future()) {}
          std::future<T>& get_future() { return future_; }
-         void set_detached_task(std::coroutine_handle<promise_type> h) { this->release_detached_ = h; }
          std::future<T> future_;
       };
 
@@ -73,8 +78,14 @@ namespace rdmapp
       {
          std::coroutine_handle<promise_type> h_;
          task_awaiter(std::coroutine_handle<promise_type> h) : h_(h) {}
-         bool await_ready() { return h_.done(); }
-         auto await_suspend(std::coroutine_handle<> suspended) { h_.promise().continuation_ = suspended; }
+         bool await_ready() { return h_.promise().waiter_.load(std::memory_order_acquire) == promise_type::kDone; }
+         bool await_suspend(std::coroutine_handle<> suspended)
+         {
+            void* expected = nullptr;
+            // Fails if the task finished after await_ready(), in which case the awaiter resumes right away.
+            return h_.promise().waiter_.compare_exchange_strong(expected, suspended.address(),
+                                                                std::memory_order_acq_rel, std::memory_order_acquire);
+         }
          auto await_resume() { return h_.promise().future_.get(); }
       };
 
@@ -85,12 +96,11 @@ namespace rdmapp
       ~task()
       {
          if (!detached_) {
-            if (!h_.done()) {
-               h_.promise().set_detached_task(h_);
-               get_future().wait();
-            }
-            else {
-               h_.destroy();
+            // Once released, the frame may free itself at any moment, and the future with it.
+            auto future = std::move(get_future());
+            release();
+            if (future.valid()) {
+               future.wait();
             }
          }
       }
@@ -103,9 +113,18 @@ namespace rdmapp
       void detach()
       {
          assert(!detached_);
-         h_.promise().set_detached_task(h_);
+         release();
          detached_ = true;
       }
+
+     private:
+      // Leave the frame to final_suspend, or free it now if the coroutine has already finished.
+      void release()
+      {
+         if (h_.promise().waiter_.exchange(promise_type::kDetached, std::memory_order_acq_rel) == promise_type::kDone) {
+            h_.destroy();
+         }
+      }
    };
 
 } // namespace rdmapp
\ No newline at end of file
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+#include "rdmapp/detail/util.h"
+
+namespace rdmapp
+{
+   /**
+    * @brief An intrusive timer. Like a completion_record, it is owned by whoever schedules it, so arming a timer does
+    * not allocate. It must stay put while it is scheduled.
+    */
+   struct timer_record
+   {
+      using fire_fn = void (*)(timer_record* self);
+      fire_fn fire{}; // Called by the wheel once the deadline has passed, unless the timer was cancelled first.
+
+      explicit timer_record(fire_fn fire = nullptr) : fire(fire) {}
+      timer_record(const timer_record&) = delete;
+      timer_record& operator=(const timer_record&) = delete;
+
+     private:
+      friend class timer_wheel;
+      timer_record* prev_{};
+      timer_record* next_{};
+      uint64_t expiry_{}; // The tick the timer fires at.
+      bool scheduled_{};
+   };
+
+   /**
+    * @brief A hashed timing wheel. Deadlines are rounded up to a tick of the given resolution and hashed into one of
+    * kSlotCount slots, so scheduling and cancelling a timer take constant time, and advancing the wheel only looks at
+    * the slots of the ticks that passed.
+    *
+    * The wheel has no thread of its own: it is driven by whoever calls advance(), such as the thread of a cq_poller.
+    * Timers fire on that thread with the wheel locked, so their fire functions must be short and must not schedule or
+    * cancel timers of the same wheel. In exchange, once cancel() returns, the timer is neither firing nor going to.
+    *
+    * A driver that sleeps between advance() calls, such as an event loop, learns of new deadlines through
+    * on_schedule() and of the next one to wait for through next_deadline().
+    */
+   class timer_wheel : public noncopyable
+   {
+     public:
+      using clock = std::chrono::steady_clock;
+      static constexpr size_t kSlotCount = 256;
+
+      explicit timer_wheel(clock::duration resolution = std::chrono::milliseconds(1))
+         : resolution_(resolution), origin_(clock::now())
+      {}
+
+      /**
+       * @brief Schedule a timer. A deadline that has already passed fires on the next advance().
+       *
+       * @param timer The timer, which must not be scheduled already.
+       * @param deadline When the timer fires.
+       */
+      void schedule(timer_record& timer, clock::time_point deadline)
+      {
+         {
+            std::lock_guard lock(mutex_);
+            timer.expiry_ = std::max(tick_of(deadline), current_ + 1);
+            auto& head = slots_[timer.expiry_ % kSlotCount];
+            timer.prev_ = nullptr;
+            timer.next_ = head;
+            if (head != nullptr) {
+               head->prev_ = &timer;
+            }
+            head = &timer;
+            timer.scheduled_ = true;
+            scheduled_.fetch_add(1, std::memory_order_release);
+         }
+         if (on_schedule_) {
+            on_schedule_(deadline);
+         }
+      }
+
+      /**
+       * @brief Set a function called with the deadline of every timer scheduled, on the scheduling thread and without
+       * the wheel locked. It must be set before any timer is scheduled.
+       *
+       * @param fn The function.
+       */
+      void on_schedule(std::function<void(clock::time_point)> fn) { on_schedule_ = std::move(fn); }
+
+      /**
+       * @brief The earliest point in time at which advance() may fire a timer. A timer more than kSlotCount ticks away
+       * makes it early, never late.
+       *
+       * @return std::optional<clock::time_point> The point in time, or nothing if no timer is scheduled.
+       */
+      std::optional<clock::time_point> next_deadline()
+      {
+         std::lock_guard lock(mutex_);
+         for (uint64_t tick = current_ + 1; tick <= current_ + kSlotCount; ++tick) {
+            if (slots_[tick % kSlotCount] != nullptr) {
+               return origin_ + tick * resolution_;
+            }
+         }
+         return std::nullopt;
+      }
+
+      /**
+       * @brief Cancel a timer. If the timer is firing on another thread, wait for it to finish.
+       *
+       * @param timer The timer.
+       * @return true If the timer was cancelled before firing.
+       * @return false If the timer has fired or was not scheduled.
+       */
+      bool cancel(timer_record& timer)
+      {
+         std::lock_guard lock(mutex_);
+         if (!timer.scheduled_) {
+            return false;
+         }
+         unlink(timer);
+         return true;
+      }
+
+      /**
+       * @brief Fire the timers whose deadline has passed. Does not read the clock if no timer is scheduled.
+       *
+       * @return size_t The number of timers fired.
+       */
+      size_t advance()
+      {
+         if (empty()) {
+            return 0;
+         }
+         return advance(clock::now());
+      }
+
+      /**
+       * @brief Fire the timers whose deadline is at or before a point in time.
+       *
+       * @param now The point in time.
+       * @return size_t The number of timers fired.
+       */
+      size_t advance(clock::time_point now)
+      {
+         std::lock_guard lock(mutex_);
+         auto target = now < origin_ ? 0 : static_cast<uint64_t>((now - origin_) / resolution_);
+         if (target <= current_) {
+            return 0;
+         }
+         // Beyond a full turn every slot has been visited, and each timer is checked against the target itself.
+         auto steps = std::min<uint64_t>(target - current_, kSlotCount);
+         size_t fired = 0;
+         for (uint64_t i = 1; i <= steps; ++i) {
+            auto timer = slots_[(current_ + i) % kSlotCount];
+            while (timer != nullptr) {
+               auto next = timer->next_;
+               if (timer->expiry_ <= target) {
+                  unlink(*timer);
+                  timer->fire(timer);
+                  ++fired;
+               }
+               timer = next;
+            }
+         }
+         current_ = target;
+         return fired;
+      }
+
+      // Whether no timer is scheduled.
+      bool empty() const { return scheduled_.load(std::memory_order_acquire) == 0; }
+
+     private:
+      // Rounded up, so that a timer never fires before its deadline.
+      uint64_t tick_of(clock::time_point deadline) const
+      {
+         if (deadline <= origin_) {
+            return 0;
+         }
+         return static_cast<uint64_t>((deadline - origin_ + resolution_ - clock::duration(1)) / resolution_);
+      }
+
+      void unlink(timer_record& timer)
+      {
+         if (timer.prev_ != nullptr) {
+            timer.prev_->next_ = timer.next_;
+         }
+         else {
+            slots_[timer.expiry_ % kSlotCount] = timer.next_;
+         }
+         if (timer.next_ != nullptr) {
+            timer.next_->prev_ = timer.prev_;
+         }
+         timer.prev_ = timer.next_ = nullptr;
+         timer.scheduled_ = false;
+         scheduled_.fetch_sub(1, std::memory_order_relaxed);
+      }
+
+      std::mutex mutex_;
+      const clock::duration resolution_;
+      const clock::time_point origin_;
+      uint64_t current_{}; // The last tick advanced to.
+      std::atomic<size_t> scheduled_{};
+      std::array<timer_record*, kSlotCount> slots_{};
+      std::function<void(clock::time_point)> on_schedule_;
+   };
+} // namespace rdmapp
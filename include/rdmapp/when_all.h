@@ -0,0 +1,240 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "rdmapp/detail/frame_pool.h"
+#include "rdmapp/lazy_task.h"
+
+namespace rdmapp
+{
+   namespace detail
+   {
+      template <class A>
+      auto get_awaiter(A& awaitable) -> decltype(awaitable.operator co_await())
+      {
+         return awaitable.operator co_await();
+      }
+
+      template <class A>
+         requires(!requires(A& awaitable) { awaitable.operator co_await(); })
+      A& get_awaiter(A& awaitable)
+      {
+         return awaitable;
+      }
+
+      // What co_await on an lvalue of A returns, with references and cv-qualifiers dropped.
+      template <class A>
+      using await_result_t = std::remove_cvref_t<decltype(get_awaiter(std::declval<A&>()).await_resume())>;
+
+      template <class A>
+      concept awaitable = requires(A& a) { get_awaiter(a).await_ready(); };
+
+      // Results of void operations are reported as std::monostate, so that they can be stored.
+      template <class T>
+      using non_void_t = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+      // Counts the operations of a when_all that have not completed, plus one for the awaiting coroutine.
+      class when_all_counter
+      {
+         std::atomic<size_t> count_;
+         std::coroutine_handle<> parent_;
+
+        public:
+         explicit when_all_counter(size_t n) : count_(n + 1) {}
+
+         // Called by the awaiting coroutine once all operations are started. Returns false if they are all done.
+         bool try_suspend(std::coroutine_handle<> parent)
+         {
+            parent_ = parent;
+            return count_.fetch_sub(1, std::memory_order_acq_rel) > 1;
+         }
+
+         // Called by each operation as it completes. Returns the coroutine to transfer to.
+         std::coroutine_handle<> arrive() noexcept
+         {
+            return count_.fetch_sub(1, std::memory_order_acq_rel) == 1 ? parent_ : std::noop_coroutine();
+         }
+      };
+
+      // Runs one operation of a when_all and keeps its result until the frame is destroyed by the when_all.
+      template <class T>
+      class when_all_task
+      {
+        public:
+         struct promise_type : public lazy_result<T>, public pooled_frame
+         {
+            when_all_counter* counter_{};
+
+            when_all_task get_return_object()
+            {
+               return when_all_task(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+
+            auto final_suspend() noexcept
+            {
+               struct awaiter
+               {
+                  bool await_ready() noexcept { return false; }
+                  std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+                  {
+                     return h.promise().counter_->arrive();
+                  }
+                  void await_resume() noexcept {}
+               };
+               return awaiter{};
+            }
+         };
+
+         when_all_task(when_all_task&& other) noexcept : h_(std::exchange(other.h_, nullptr)) {}
+
+         ~when_all_task()
+         {
+            if (h_) {
+               h_.destroy();
+            }
+         }
+
+         void start(when_all_counter& counter)
+         {
+            h_.promise().counter_ = &counter;
+            h_.resume();
+         }
+
+         decltype(auto) result() { return h_.promise().get(); }
+
+         non_void_t<T> non_void_result()
+         {
+            if constexpr (std::is_void_v<T>) {
+               h_.promise().get();
+               return {};
+            }
+            else {
+               return h_.promise().get();
+            }
+         }
+
+        private:
+         explicit when_all_task(std::coroutine_handle<promise_type> h) : h_(h) {}
+         std::coroutine_handle<promise_type> h_;
+      };
+
+      template <class A, class T = await_result_t<A>>
+      when_all_task<T> make_when_all_task(A awaitable)
+      {
+         if constexpr (std::is_void_v<T>) {
+            co_await awaitable;
+         }
+         else {
+            co_return co_await awaitable;
+         }
+      }
+
+      template <class... Ts>
+      class when_all_awaitable
+      {
+         when_all_counter counter_;
+         std::tuple<when_all_task<Ts>...> tasks_;
+
+        public:
+         explicit when_all_awaitable(when_all_task<Ts>... tasks) : counter_(sizeof...(Ts)), tasks_(std::move(tasks)...)
+         {}
+
+         bool await_ready() const noexcept { return sizeof...(Ts) == 0; }
+
+         bool await_suspend(std::coroutine_handle<> h)
+         {
+            std::apply([this](auto&... tasks) { (tasks.start(counter_), ...); }, tasks_);
+            return counter_.try_suspend(h);
+         }
+
+         std::tuple<non_void_t<Ts>...> await_resume()
+         {
+            return std::apply([](auto&... tasks) { return std::tuple<non_void_t<Ts>...>{tasks.non_void_result()...}; },
+                              tasks_);
+         }
+      };
+
+      template <class T>
+      class when_all_range_awaitable
+      {
+         when_all_counter counter_;
+         std::vector<when_all_task<T>> tasks_;
+
+        public:
+         explicit when_all_range_awaitable(std::vector<when_all_task<T>> tasks)
+            : counter_(tasks.size()), tasks_(std::move(tasks))
+         {}
+
+         bool await_ready() const noexcept { return tasks_.empty(); }
+
+         bool await_suspend(std::coroutine_handle<> h)
+         {
+            for (auto& task : tasks_) {
+               task.start(counter_);
+            }
+            return counter_.try_suspend(h);
+         }
+
+         auto await_resume()
+         {
+            if constexpr (std::is_void_v<T>) {
+               for (auto& task : tasks_) {
+                  task.result();
+               }
+            }
+            else {
+               std::vector<T> results;
+               results.reserve(tasks_.size());
+               for (auto& task : tasks_) {
+                  results.push_back(task.result());
+               }
+               return results;
+            }
+         }
+      };
+   } // namespace detail
+
+   /**
+    * @brief Await several operations at once. Each operation is started in turn, so that all of them are posted
+    * before the awaiting coroutine suspends, and the awaiting coroutine is resumed once, by whichever completes last.
+    *
+    * @param awaitables The operations, such as send_awaitable, recv_awaitable or task. They are moved into the
+    * returned awaitable.
+    * @return auto An awaitable that returns a std::tuple of the results, with std::monostate for operations returning
+    * void. If operations failed, the exception of the first of them is rethrown once all have completed.
+    */
+   template <detail::awaitable... Awaitables>
+   auto when_all(Awaitables... awaitables)
+   {
+      return detail::when_all_awaitable<detail::await_result_t<Awaitables>...>(
+         detail::make_when_all_task(std::move(awaitables))...);
+   }
+
+   /**
+    * @brief Await a range of operations of the same type at once. See when_all() above.
+    *
+    * @param awaitables The operations. They are moved into the returned awaitable.
+    * @return auto An awaitable that returns a std::vector of the results in the order of the operations, or nothing
+    * if the operations return void.
+    */
+   template <detail::awaitable Awaitable>
+   auto when_all(std::vector<Awaitable> awaitables)
+   {
+      using result_type = detail::await_result_t<Awaitable>;
+      std::vector<detail::when_all_task<result_type>> tasks;
+      tasks.reserve(awaitables.size());
+      for (auto& awaitable : awaitables) {
+         tasks.push_back(detail::make_when_all_task(std::move(awaitable)));
+      }
+      return detail::when_all_range_awaitable<result_type>(std::move(tasks));
+   }
+} // namespace rdmapp
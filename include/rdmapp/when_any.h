@@ -0,0 +1,233 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "rdmapp/detail/frame_pool.h"
+#include "rdmapp/error.h"
+#include "rdmapp/when_all.h"
+
+namespace rdmapp
+{
+   namespace detail
+   {
+      // Shared by a when_any and its operations, which may still be running after the awaiting coroutine resumed.
+      template <class Result>
+      struct when_any_state
+      {
+         std::atomic<bool> claimed_{};
+         // One for the first operation to complete and one for the awaiting coroutine, once it has started them all.
+         std::atomic<int> gate_{2};
+         std::coroutine_handle<> parent_;
+         std::optional<Result> result_;
+         std::exception_ptr exception_;
+
+         bool claimed() const { return claimed_.load(std::memory_order_acquire); }
+
+         // Returns true for the first operation to complete only.
+         bool claim() { return !claimed_.exchange(true, std::memory_order_acq_rel); }
+
+         // Called by the awaiting coroutine once all operations are started. Returns false if one has completed.
+         bool try_suspend() { return gate_.fetch_sub(1, std::memory_order_acq_rel) > 1; }
+
+         // Called by the first operation to complete. Returns the coroutine to transfer to.
+         std::coroutine_handle<> arrive() noexcept
+         {
+            return gate_.fetch_sub(1, std::memory_order_acq_rel) == 1 ? parent_ : std::noop_coroutine();
+         }
+      };
+
+      // Runs one operation of a when_any. Once started, the frame frees itself when the operation completes.
+      class when_any_task
+      {
+        public:
+         struct promise_type : public pooled_frame
+         {
+            std::coroutine_handle<> next_;
+
+            when_any_task get_return_object()
+            {
+               return when_any_task(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+
+            auto final_suspend() noexcept
+            {
+               struct awaiter
+               {
+                  bool await_ready() noexcept { return false; }
+                  std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+                  {
+                     auto next = h.promise().next_;
+                     h.destroy();
+                     return next;
+                  }
+                  void await_resume() noexcept {}
+               };
+               return awaiter{};
+            }
+
+            void return_value(std::coroutine_handle<> next) { next_ = next; }
+
+            // The coroutine body catches everything.
+            void unhandled_exception() noexcept { std::terminate(); }
+         };
+
+         when_any_task(when_any_task&& other) noexcept : h_(std::exchange(other.h_, nullptr)) {}
+
+         // Operations that were never started are dropped without being posted.
+         ~when_any_task()
+         {
+            if (h_) {
+               h_.destroy();
+            }
+         }
+
+         void start() { std::exchange(h_, nullptr).resume(); }
+
+        private:
+         explicit when_any_task(std::coroutine_handle<promise_type> h) : h_(h) {}
+         std::coroutine_handle<promise_type> h_;
+      };
+
+      template <class Result, class A, class Store>
+      when_any_task make_when_any_task(std::shared_ptr<when_any_state<Result>> state, A awaitable, Store store)
+      {
+         bool won = false;
+         try {
+            if constexpr (std::is_void_v<await_result_t<A>>) {
+               co_await awaitable;
+               if ((won = state->claim())) {
+                  store(*state, std::monostate{});
+               }
+            }
+            else {
+               auto value = co_await awaitable;
+               if ((won = state->claim())) {
+                  store(*state, std::move(value));
+               }
+            }
+         }
+         catch (...) {
+            if (won || state->claim()) {
+               won = true;
+               state->exception_ = std::current_exception();
+            }
+         }
+         co_return won ? state->arrive() : std::noop_coroutine();
+      }
+
+      template <class Result>
+      class when_any_awaitable
+      {
+         std::shared_ptr<when_any_state<Result>> state_;
+         std::vector<when_any_task> tasks_;
+
+        public:
+         when_any_awaitable(std::shared_ptr<when_any_state<Result>> state, std::vector<when_any_task> tasks)
+            : state_(std::move(state)), tasks_(std::move(tasks))
+         {}
+
+         bool await_ready() const noexcept { return false; }
+
+         bool await_suspend(std::coroutine_handle<> h)
+         {
+            state_->parent_ = h;
+            for (auto& task : tasks_) {
+               if (state_->claimed()) {
+                  break;
+               }
+               task.start();
+            }
+            tasks_.clear();
+            return state_->try_suspend();
+         }
+
+         Result await_resume()
+         {
+            // Taken out of the state, which may be released by an operation that is still running on another thread.
+            if (auto exception = std::exchange(state_->exception_, nullptr)) {
+               std::rethrow_exception(exception);
+            }
+            return std::move(*state_->result_);
+         }
+      };
+
+      template <class Result, class... Awaitables, size_t... Is>
+      auto make_when_any(std::index_sequence<Is...>, Awaitables... awaitables)
+      {
+         auto state = std::make_shared<when_any_state<Result>>();
+         std::vector<when_any_task> tasks;
+         tasks.reserve(sizeof...(Awaitables));
+         (tasks.push_back(make_when_any_task(state, std::move(awaitables),
+                                             [](when_any_state<Result>& target, auto&& value) {
+                                                target.result_.emplace(std::in_place_index<Is>,
+                                                                      std::forward<decltype(value)>(value));
+                                             })),
+          ...);
+         return when_any_awaitable<Result>(std::move(state), std::move(tasks));
+      }
+   } // namespace detail
+
+   /**
+    * @brief Await the first of several operations to complete. Operations are started in turn until one completes,
+    * and the awaiting coroutine suspends once. RDMA operations cannot be cancelled, so those already posted keep
+    * running after the awaiting coroutine has resumed, and their results are dropped. Their buffers must stay valid
+    * until they complete.
+    *
+    * @param awaitables The operations, such as send_awaitable, recv_awaitable or task. They are moved into the
+    * returned awaitable.
+    * @return auto An awaitable that returns a std::variant holding the result of the first operation to complete, at
+    * the index of that operation, with std::monostate for operations returning void. If that operation failed, its
+    * exception is rethrown.
+    */
+   template <detail::awaitable... Awaitables>
+      requires(sizeof...(Awaitables) > 0)
+   auto when_any(Awaitables... awaitables)
+   {
+      using result_type = std::variant<detail::non_void_t<detail::await_result_t<Awaitables>>...>;
+      return detail::make_when_any<result_type>(std::index_sequence_for<Awaitables...>{}, std::move(awaitables)...);
+   }
+
+   /**
+    * @brief Await the first of a range of operations of the same type to complete. See when_any() above.
+    *
+    * @param awaitables The operations. There must be at least one. They are moved into the returned awaitable.
+    * @return auto An awaitable that returns the index of the first operation to complete and its result, or only its
+    * index if the operations return void.
+    */
+   template <detail::awaitable Awaitable>
+   auto when_any(std::vector<Awaitable> awaitables)
+   {
+      using value_type = detail::await_result_t<Awaitable>;
+      using result_type =
+         std::conditional_t<std::is_void_v<value_type>, size_t, std::pair<size_t, detail::non_void_t<value_type>>>;
+      if (awaitables.empty()) {
+         throw_with("when_any needs at least one operation");
+      }
+      auto state = std::make_shared<detail::when_any_state<result_type>>();
+      std::vector<detail::when_any_task> tasks;
+      tasks.reserve(awaitables.size());
+      for (size_t i = 0; i < awaitables.size(); ++i) {
+         tasks.push_back(detail::make_when_any_task(
+            state, std::move(awaitables[i]), [i](detail::when_any_state<result_type>& target, auto&& value) {
+               if constexpr (std::is_void_v<value_type>) {
+                  target.result_.emplace(i);
+               }
+               else {
+                  target.result_.emplace(i, std::forward<decltype(value)>(value));
+               }
+            }));
+      }
+      return detail::when_any_awaitable<result_type>(std::move(state), std::move(tasks));
+   }
+} // namespace rdmapp
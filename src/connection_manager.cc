@@ -0,0 +1,432 @@
+#include "rdmapp/connection_manager.h"
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <rdma/rdma_cma.h>
+#include <strings.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <coroutine>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "rdmapp/detail/debug.h"
+#include "rdmapp/error.h"
+#include "rdmapp/lazy_task.h"
+
+namespace rdmapp
+{
+   namespace detail
+   {
+      static constexpr int kResolveTimeoutMs = 2000;
+
+      // The parts of an event that are still needed after it is acknowledged.
+      struct cm_event
+      {
+         rdma_cm_event_type type;
+         int status;
+         rdma_cm_id* id;
+         std::vector<uint8_t> private_data;
+      };
+
+      // The events of one id, handed from the event thread to the coroutine waiting for them.
+      struct cm_event_queue
+      {
+         struct awaitable
+         {
+            cm_event_queue& queue_;
+            cm_event event_{};
+            std::coroutine_handle<> h_;
+
+            bool await_ready() const noexcept { return false; }
+
+            bool await_suspend(std::coroutine_handle<> h)
+            {
+               std::lock_guard lock(queue_.mutex_);
+               if (!queue_.events_.empty()) {
+                  event_ = std::move(queue_.events_.front());
+                  queue_.events_.pop_front();
+                  return false;
+               }
+               h_ = h;
+               queue_.waiter_ = this;
+               return true;
+            }
+
+            cm_event await_resume() { return std::move(event_); }
+         };
+
+         std::mutex mutex_;
+         std::deque<cm_event> events_;
+         awaitable* waiter_{};
+         bool ignored_{}; // Set once nobody waits for the events of the id, such as after it is connected.
+
+         awaitable next() { return awaitable{*this, {}, {}}; }
+
+         // Hands an event to the waiting coroutine, or queues it. Returns the coroutine to resume, if any, which must
+         // only be resumed once the event is acknowledged, as it may destroy the id.
+         std::coroutine_handle<> push(cm_event event)
+         {
+            std::lock_guard lock(mutex_);
+            if (ignored_) {
+               RDMAPP_LOG_DEBUG("dropped cm event %s status=%d id=%p", ::rdma_event_str(event.type), event.status,
+                                reinterpret_cast<void*>(event.id));
+               return nullptr;
+            }
+            if (waiter_ == nullptr) {
+               events_.push_back(std::move(event));
+               return nullptr;
+            }
+            auto waiter = std::exchange(waiter_, nullptr);
+            waiter->event_ = std::move(event);
+            return waiter->h_;
+         }
+
+         // Drops the queued events and those to come.
+         void ignore()
+         {
+            std::lock_guard lock(mutex_);
+            ignored_ = true;
+            events_.clear();
+         }
+      };
+
+      // Owns the event channel and the thread that dispatches its events to the ids. The thread holds a reference,
+      // so the channel survives an id or manager being released by a coroutine resumed on it.
+      struct cm_channel : public noncopyable, public std::enable_shared_from_this<cm_channel>
+      {
+         rdma_event_channel* channel{};
+         int stop_fd{-1};
+         std::thread thread;
+
+         cm_channel()
+         {
+            channel = ::rdma_create_event_channel();
+            check_ptr(channel, "failed to create cm event channel");
+            stop_fd = ::eventfd(0, EFD_CLOEXEC);
+            if (stop_fd < 0 || ::fcntl(channel->fd, F_SETFL, ::fcntl(channel->fd, F_GETFL) | O_NONBLOCK) < 0) {
+               auto error = errno;
+               if (stop_fd >= 0) {
+                  ::close(stop_fd);
+               }
+               ::rdma_destroy_event_channel(channel);
+               errno = error;
+               check_errno(-1, "failed to set up cm event channel");
+            }
+         }
+
+         void start()
+         {
+            thread = std::thread([self = shared_from_this()]() { self->worker(); });
+         }
+
+         void worker()
+         {
+            struct pollfd fds[2] = {{channel->fd, POLLIN, 0}, {stop_fd, POLLIN, 0}};
+            while (true) {
+               if (::poll(fds, 2, -1) < 0) {
+                  if (errno == EINTR) {
+                     continue;
+                  }
+                  RDMAPP_LOG_ERROR("failed to poll cm event channel: %s", strerror(errno));
+                  return;
+               }
+               if (fds[1].revents != 0) {
+                  return;
+               }
+               rdma_cm_event* event;
+               while (::rdma_get_cm_event(channel, &event) == 0) {
+                  dispatch(event);
+               }
+            }
+         }
+
+         static void dispatch(rdma_cm_event* event)
+         {
+            cm_event copy{event->event, event->status, event->id, {}};
+            auto const& conn = event->param.conn;
+            // The payload is prefixed with its length, because InfiniBand pads private data.
+            if (conn.private_data != nullptr && conn.private_data_len > 0) {
+               auto data = static_cast<const uint8_t*>(conn.private_data);
+               size_t length = std::min<size_t>(data[0], conn.private_data_len - 1);
+               copy.private_data.assign(data + 1, data + 1 + length);
+            }
+            RDMAPP_LOG_TRACE("cm event %s status=%d id=%p", ::rdma_event_str(copy.type), copy.status,
+                             reinterpret_cast<void*>(copy.id));
+            cm_event_queue* queue = nullptr;
+            if (copy.type == RDMA_CM_EVENT_CONNECT_REQUEST) {
+               // The new id inherits the listener's context until accept() adopts it.
+               event->id->context = nullptr;
+               queue = event_queue(event->listen_id);
+            }
+            else {
+               queue = event_queue(event->id);
+            }
+            // Until the event is acknowledged, rdma_destroy_id() blocks, so the id and its queue are still alive.
+            std::coroutine_handle<> waiter;
+            if (queue != nullptr) {
+               waiter = queue->push(std::move(copy));
+            }
+            ::rdma_ack_cm_event(event);
+            if (waiter) {
+               waiter.resume();
+            }
+         }
+
+         static cm_event_queue* event_queue(rdma_cm_id* id);
+
+         void stop()
+         {
+            if (!thread.joinable()) {
+               return;
+            }
+            uint64_t one = 1;
+            if (::write(stop_fd, &one, sizeof(one)) != sizeof(one)) {
+               RDMAPP_LOG_ERROR("failed to stop cm event thread: %s", strerror(errno));
+            }
+            if (thread.get_id() == std::this_thread::get_id()) {
+               thread.detach();
+            }
+            else {
+               thread.join();
+            }
+         }
+
+         ~cm_channel()
+         {
+            stop();
+            ::close(stop_fd);
+            ::rdma_destroy_event_channel(channel);
+         }
+      };
+
+      // An rdma_cm_id and the events addressed to it. It keeps the event channel alive, which must outlive its ids.
+      struct cm_id : public noncopyable
+      {
+         std::shared_ptr<cm_channel> channel;
+         rdma_cm_id* id{};
+         cm_event_queue events;
+
+         cm_id(std::shared_ptr<cm_channel> channel_in) : channel(std::move(channel_in))
+         {
+            check_errno(::rdma_create_id(channel->channel, &id, this, RDMA_PS_TCP), "failed to create cm id");
+         }
+
+         // Adopts the id of a connection request.
+         cm_id(std::shared_ptr<cm_channel> channel_in, rdma_cm_id* id_in) : channel(std::move(channel_in)), id(id_in)
+         {
+            id->context = this;
+         }
+
+         // Waits for the next event, which must be of the given type.
+         lazy_task<cm_event> expect(rdma_cm_event_type type)
+         {
+            auto event = co_await events.next();
+            if (event.type != type) {
+               throw_with("expected cm event %s but got %s (status=%d)", ::rdma_event_str(type),
+                          ::rdma_event_str(event.type), event.status);
+            }
+            co_return std::move(event);
+         }
+
+         ~cm_id()
+         {
+            if (auto rc = ::rdma_destroy_id(id); rc != 0) {
+               RDMAPP_LOG_ERROR("failed to destroy cm id %p: %s", reinterpret_cast<void*>(id), strerror(errno));
+            }
+         }
+      };
+
+      cm_event_queue* cm_channel::event_queue(rdma_cm_id* id)
+      {
+         auto owner = static_cast<cm_id*>(id->context);
+         return owner == nullptr ? nullptr : &owner->events;
+      }
+
+      // Keeps the id of a connection alive as long as its Queue Pair. The Queue Pair is destroyed first.
+      struct cm_connection
+      {
+         std::unique_ptr<cm_id> id;
+         std::shared_ptr<queue_pair> qp;
+
+         ~cm_connection()
+         {
+            // Lets the peer know, rather than leaving it to time out. It fails if the peer disconnected first.
+            if (::rdma_disconnect(id->id) != 0) {
+               RDMAPP_LOG_DEBUG("failed to disconnect cm id %p: %s", reinterpret_cast<void*>(id->id), strerror(errno));
+            }
+         }
+      };
+
+      static std::shared_ptr<queue_pair> bind(std::unique_ptr<cm_id> id, std::shared_ptr<queue_pair> qp)
+      {
+         // Events such as RDMA_CM_EVENT_DISCONNECTED are not awaited once connected.
+         id->events.ignore();
+         auto connection = std::make_shared<cm_connection>(std::move(id), std::move(qp));
+         return std::shared_ptr<queue_pair>(connection, connection->qp.get());
+      }
+
+      static std::unique_ptr<addrinfo, decltype(&::freeaddrinfo)> resolve(const std::string& hostname, uint16_t port,
+                                                                         bool passive)
+      {
+         struct addrinfo hints, *result = nullptr;
+         ::bzero(&hints, sizeof(hints));
+         hints.ai_family = AF_UNSPEC;
+         hints.ai_socktype = SOCK_STREAM;
+         hints.ai_flags = passive ? AI_PASSIVE : 0;
+         auto const port_str = std::to_string(port);
+         auto node = hostname.empty() ? nullptr : hostname.c_str();
+         if (auto rc = ::getaddrinfo(node, port_str.c_str(), &hints, &result); rc != 0) {
+            throw_with("failed to getaddrinfo: %s", ::gai_strerror(rc));
+         }
+         return {result, &::freeaddrinfo};
+      }
+
+      // Moves the Queue Pair to the next state with the attributes negotiated by the connection manager.
+      static void transition(cm_id& id, queue_pair& qp, ibv_qp_state state)
+      {
+         struct ibv_qp_attr attr;
+         ::bzero(&attr, sizeof(attr));
+         attr.qp_state = state;
+         int mask = 0;
+         check_errno(::rdma_init_qp_attr(id.id, &attr, &mask), "failed to get qp attributes from cm");
+         qp.modify(attr, mask);
+      }
+
+      static rdma_conn_param conn_param(const queue_pair& qp, bool srq, const std::vector<uint8_t>& payload)
+      {
+         rdma_conn_param param;
+         ::bzero(&param, sizeof(param));
+         param.private_data = payload.data();
+         param.private_data_len = payload.size();
+         param.responder_resources = 1;
+         param.initiator_depth = 1;
+         param.retry_count = 7;
+         param.rnr_retry_count = 7;
+         param.srq = srq;
+         param.qp_num = qp.qp_num();
+         return param;
+      }
+
+      static std::vector<uint8_t> pack(const std::vector<uint8_t>& private_data, size_t limit)
+      {
+         if (private_data.size() > limit) {
+            throw_with("private data of %zu bytes exceeds the limit of %zu", private_data.size(), limit);
+         }
+         std::vector<uint8_t> payload;
+         payload.reserve(private_data.size() + 1);
+         payload.push_back(static_cast<uint8_t>(private_data.size()));
+         payload.insert(payload.end(), private_data.begin(), private_data.end());
+         return payload;
+      }
+   } // namespace detail
+
+   connection_manager::connection_manager(std::shared_ptr<protected_domain> pd, std::shared_ptr<completion_queue> recv_cq,
+                                          std::shared_ptr<completion_queue> send_cq,
+                                          std::shared_ptr<shared_receive_queue> srq)
+      : channel_(std::make_shared<detail::cm_channel>()), pd_(pd), recv_cq_(recv_cq), send_cq_(send_cq), srq_(srq)
+   {
+      channel_->start();
+   }
+
+   connection_manager::connection_manager(std::shared_ptr<protected_domain> pd, std::shared_ptr<completion_queue> cq,
+                                          std::shared_ptr<shared_receive_queue> srq)
+      : connection_manager(pd, cq, cq, srq)
+   {}
+
+   std::shared_ptr<queue_pair> connection_manager::create_qp(detail::cm_id& id)
+   {
+      if (id.id->verbs != pd_->device->ctx) {
+         throw_with("connection resolved to device %s, but the protection domain belongs to %s",
+                    ::ibv_get_device_name(id.id->verbs->device), ::ibv_get_device_name(pd_->device->device_ptr));
+      }
+      return std::make_shared<queue_pair>(pd_, recv_cq_, send_cq_, srq_);
+   }
+
+   void connection_manager::listen(const std::string& hostname, uint16_t port, int backlog)
+   {
+      auto id = std::make_unique<detail::cm_id>(channel_);
+      auto address = detail::resolve(hostname, port, true);
+      check_errno(::rdma_bind_addr(id->id, address->ai_addr), "failed to bind cm id");
+      check_errno(::rdma_listen(id->id, backlog), "failed to listen on cm id");
+      RDMAPP_LOG_DEBUG("cm listening on %s:%u", hostname.c_str(), port);
+      listener_ = std::move(id);
+   }
+
+   task<std::shared_ptr<queue_pair>> connection_manager::accept(std::vector<uint8_t> private_data)
+   {
+      if (listener_ == nullptr) {
+         throw_with("connection manager is not listening");
+      }
+      auto payload = detail::pack(private_data, kMaxAcceptPrivateData);
+      detail::cm_event request;
+      do {
+         request = co_await listener_->events.next();
+      } while (request.type != RDMA_CM_EVENT_CONNECT_REQUEST);
+      auto id = std::make_unique<detail::cm_id>(channel_, request.id);
+      std::shared_ptr<queue_pair> qp;
+      try {
+         qp = create_qp(*id);
+         detail::transition(*id, *qp, IBV_QPS_RTR);
+         detail::transition(*id, *qp, IBV_QPS_RTS);
+         auto param = detail::conn_param(*qp, srq_ != nullptr, payload);
+         check_errno(::rdma_accept(id->id, &param), "failed to accept cm connection");
+      }
+      catch (...) {
+         // Otherwise the peer waits for an answer until the connection manager times out.
+         ::rdma_reject(id->id, nullptr, 0);
+         throw;
+      }
+      co_await id->expect(RDMA_CM_EVENT_ESTABLISHED);
+      qp->user_data() = std::move(request.private_data);
+      co_return detail::bind(std::move(id), std::move(qp));
+   }
+
+   task<std::shared_ptr<queue_pair>> connection_manager::connect(const std::string& hostname, uint16_t port,
+                                                                 std::vector<uint8_t> private_data)
+   {
+      auto payload = detail::pack(private_data, kMaxConnectPrivateData);
+      auto id = std::make_unique<detail::cm_id>(channel_);
+      {
+         auto address = detail::resolve(hostname, port, false);
+         check_errno(::rdma_resolve_addr(id->id, nullptr, address->ai_addr, detail::kResolveTimeoutMs),
+                     "failed to resolve cm address");
+      }
+      co_await id->expect(RDMA_CM_EVENT_ADDR_RESOLVED);
+      check_errno(::rdma_resolve_route(id->id, detail::kResolveTimeoutMs), "failed to resolve cm route");
+      co_await id->expect(RDMA_CM_EVENT_ROUTE_RESOLVED);
+      auto qp = create_qp(*id);
+      auto param = detail::conn_param(*qp, srq_ != nullptr, payload);
+      check_errno(::rdma_connect(id->id, &param), "failed to connect cm id");
+      // The Queue Pair is not owned by the connection manager, so it is moved to RTS here before establishing.
+      auto response = co_await id->expect(RDMA_CM_EVENT_CONNECT_RESPONSE);
+      detail::transition(*id, *qp, IBV_QPS_RTR);
+      detail::transition(*id, *qp, IBV_QPS_RTS);
+      check_errno(::rdma_establish(id->id), "failed to establish cm connection");
+      qp->user_data() = std::move(response.private_data);
+      RDMAPP_LOG_DEBUG("cm connected to %s:%u qpn=%u", hostname.c_str(), port, qp->qp_num());
+      co_return detail::bind(std::move(id), std::move(qp));
+   }
+
+   connection_manager::~connection_manager()
+   {
+      channel_->stop();
+      if (listener_ == nullptr) {
+         return;
+      }
+      for (auto& event : listener_->events.events_) {
+         if (event.type == RDMA_CM_EVENT_CONNECT_REQUEST) {
+            ::rdma_reject(event.id, nullptr, 0);
+            ::rdma_destroy_id(event.id);
+         }
+      }
+   }
+
+} // namespace rdmapp
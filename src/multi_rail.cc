@@ -0,0 +1,132 @@
+#include "rdmapp/multi_rail.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <utility>
+
+#include "rdmapp/error.h"
+#include "rdmapp/when_all.h"
+
+namespace rdmapp
+{
+   multi_rail::multi_rail(const std::vector<rail_config>& configs, std::shared_ptr<executor> exec)
+   {
+      if (configs.empty()) [[unlikely]] {
+         throw_with("multi_rail needs at least one rail");
+      }
+      if (exec == nullptr) {
+         exec = std::make_shared<executor>();
+      }
+      rails_.reserve(configs.size());
+      for (auto const& config : configs) {
+         auto device = std::make_shared<rdmapp::device>(config.device_name, config.port_num, config.gid_index);
+         auto pd = std::make_shared<protected_domain>(device);
+         auto cq = std::make_shared<completion_queue>(device);
+         auto poller = std::make_shared<cq_poller>(cq, exec);
+         rails_.push_back(rail{device, pd, cq, poller});
+         RDMAPP_LOG_DEBUG("opened rail %zu on %s port %u", rails_.size() - 1, config.device_name.c_str(),
+                          config.port_num);
+      }
+   }
+
+   multi_rail_mr multi_rail::reg_mr(void* buffer, size_t length)
+   {
+      std::vector<std::shared_ptr<local_mr>> mrs;
+      mrs.reserve(rails_.size());
+      for (auto const& rail : rails_) {
+         mrs.push_back(std::make_shared<local_mr>(rail.pd->reg_mr(buffer, length)));
+      }
+      return multi_rail_mr(buffer, length, std::move(mrs));
+   }
+
+   striped_qp::striped_qp(std::vector<std::shared_ptr<queue_pair>> qps, striped_qp_config config) : config_(config)
+   {
+      if (qps.empty()) [[unlikely]] {
+         throw_with("striped_qp needs at least one qp");
+      }
+      if (config_.stripe_size == 0 || config_.stripe_size > std::numeric_limits<uint32_t>::max()) [[unlikely]] {
+         throw_with("stripe size %zu is out of range", config_.stripe_size);
+      }
+      if (config_.max_outstanding == 0) [[unlikely]] {
+         throw_with("striped_qp needs at least one chunk in flight per rail");
+      }
+      rails_.reserve(qps.size());
+      for (auto& qp : qps) {
+         rails_.push_back(std::make_unique<rail_state>(std::move(qp), config_.max_outstanding));
+      }
+   }
+
+   lazy_task<void> striped_qp::transfer_lane(ibv_wr_opcode opcode, size_t rail, const multi_rail_remote_mr& remote,
+                                             const multi_rail_mr& local, std::atomic<size_t>& next_offset)
+   {
+      auto& state = *rails_[rail];
+      while (true) {
+         // The chunk is claimed once the rail can post it, not before.
+         co_await state.slots.acquire();
+         auto offset = next_offset.fetch_add(config_.stripe_size, std::memory_order_relaxed);
+         if (offset >= local.length()) {
+            state.slots.release();
+            co_return;
+         }
+         auto length = static_cast<uint32_t>(std::min(config_.stripe_size, local.length() - offset));
+         auto remote_mr = remote.mrs[rail];
+         remote_mr.addr = static_cast<uint8_t*>(remote_mr.addr) + offset;
+         remote_mr.length = length;
+         try {
+            if (opcode == IBV_WR_RDMA_WRITE) {
+               co_await state.qp->write(remote_mr, local.on_rail(rail), offset, length);
+            }
+            else {
+               co_await state.qp->read(remote_mr, local.on_rail(rail), offset, length);
+            }
+         }
+         catch (...) {
+            // The other rails take over the chunks left.
+            state.slots.release();
+            throw;
+         }
+         state.slots.release();
+      }
+   }
+
+   lazy_task<size_t> striped_qp::transfer(ibv_wr_opcode opcode, const multi_rail_remote_mr& remote,
+                                          const multi_rail_mr& local)
+   {
+      if (local.rails() != rails_.size() || remote.mrs.size() != rails_.size()) [[unlikely]] {
+         throw_with("buffers registered on %zu local and %zu remote rails, expected %zu", local.rails(),
+                    remote.mrs.size(), rails_.size());
+      }
+      for (auto const& mr : remote.mrs) {
+         if (mr.length < local.length()) [[unlikely]] {
+            throw_with("remote buffer of %u bytes is smaller than the local one of %zu bytes", mr.length,
+                       local.length());
+         }
+      }
+      // Each rail runs as many lanes as it may have chunks in flight, but no more than there are chunks.
+      auto chunks = (local.length() + config_.stripe_size - 1) / config_.stripe_size;
+      auto lanes_per_rail = std::min(config_.max_outstanding, chunks);
+      std::atomic<size_t> next_offset{0};
+      std::vector<lazy_task<void>> lanes;
+      lanes.reserve(lanes_per_rail * rails_.size());
+      for (size_t lane = 0; lane < lanes_per_rail; ++lane) {
+         for (size_t rail = 0; rail < rails_.size(); ++rail) {
+            lanes.push_back(transfer_lane(opcode, rail, remote, local, next_offset));
+         }
+      }
+      co_await when_all(std::move(lanes));
+      co_return local.length();
+   }
+
+   lazy_task<size_t> striped_qp::write(const multi_rail_remote_mr& remote, const multi_rail_mr& local)
+   {
+      return transfer(IBV_WR_RDMA_WRITE, remote, local);
+   }
+
+   lazy_task<size_t> striped_qp::read(const multi_rail_remote_mr& remote, const multi_rail_mr& local)
+   {
+      return transfer(IBV_WR_RDMA_READ, remote, local);
+   }
+} // namespace rdmapp
@@ -37,6 +37,14 @@ namespace rdmapp
       rts();
    }
 
+   queue_pair::queue_pair(const deserialized_qp::qp_header& remote, std::shared_ptr<protected_domain> pd,
+          std::shared_ptr<completion_queue> recv_cq, std::shared_ptr<completion_queue> send_cq, std::shared_ptr<shared_receive_queue> srq)
+      : queue_pair(pd, recv_cq, send_cq, srq)
+   {
+      rtr(remote);
+      rts();
+   }
+
    queue_pair::queue_pair(std::shared_ptr<rdmapp::protected_domain> pd, std::shared_ptr<completion_queue> cq, std::shared_ptr<shared_receive_queue> srq) : queue_pair(pd, cq, cq, srq) {}
 
    queue_pair::queue_pair(std::shared_ptr<rdmapp::protected_domain> pd, std::shared_ptr<completion_queue> recv_cq, std::shared_ptr<completion_queue> send_cq,
@@ -49,6 +57,8 @@ namespace rdmapp
 
    std::vector<uint8_t>& queue_pair::user_data() { return user_data_; }
 
+   const std::vector<uint8_t>& queue_pair::user_data() const { return user_data_; }
+
    std::shared_ptr<protected_domain> queue_pair::pd_ptr() const { return pd_; }
 
    std::vector<uint8_t> queue_pair::serialize() const
@@ -59,10 +69,20 @@ namespace rdmapp
       detail::serialize(qp_->qp_num, it);
       detail::serialize(sq_psn_, it);
       detail::serialize(static_cast<uint32_t>(user_data_.size()), it);
+      std::copy_n(pd_->device->gid.raw, sizeof(ibv_gid), it);
       std::copy(user_data_.cbegin(), user_data_.cend(), it);
       return buffer;
    }
 
+   void queue_pair::serialize_header(uint8_t* buffer) const
+   {
+      detail::serialize(pd_->device->lid(), buffer);
+      detail::serialize(qp_->qp_num, buffer);
+      detail::serialize(sq_psn_, buffer);
+      detail::serialize(static_cast<uint32_t>(user_data_.size()), buffer);
+      std::copy_n(pd_->device->gid.raw, sizeof(ibv_gid), buffer);
+   }
+
    void queue_pair::create()
    {
       struct ibv_qp_init_attr qp_init_attr = {};
@@ -72,8 +92,8 @@ namespace rdmapp
       qp_init_attr.send_cq = send_cq_->cq.get();
       qp_init_attr.cap.max_recv_sge = 1;
       qp_init_attr.cap.max_send_sge = 1;
-      qp_init_attr.cap.max_recv_wr = 128;
-      qp_init_attr.cap.max_send_wr = 128;
+      qp_init_attr.cap.max_recv_wr = max_recv_wr_ + kDrainWrs;
+      qp_init_attr.cap.max_send_wr = max_send_wr_ + kDrainWrs;
       qp_init_attr.sq_sig_all = 0;
       qp_init_attr.qp_context = this;
 
@@ -86,7 +106,22 @@ namespace rdmapp
          post_recv_fn = &queue_pair::post_recv_rq;
       }
 
+      // Make sure the CQs can hold a completion for every work request we may post.
+      send_cq_->attach(max_send_wr_ + kDrainWrs);
+      if (srq_ == nullptr) {
+         try {
+            recv_cq_->attach(max_recv_wr_ + kDrainWrs);
+         }
+         catch (const std::exception& e) {
+            send_cq_->detach(max_send_wr_ + kDrainWrs);
+            throw;
+         }
+      }
+
       qp_ = ::ibv_create_qp(pd_->pd_.get(), &qp_init_attr);
+      if (qp_ == nullptr) [[unlikely]] {
+         detach_cqs();
+      }
       check_ptr(qp_, "failed to create qp");
       sq_psn_ = next_sq_psn.fetch_add(1);
       RDMAPP_LOG_TRACE("created qp %p lid=%u qpn=%u psn=%u", reinterpret_cast<void*>(qp_), pd_->device->lid(),
@@ -113,12 +148,19 @@ namespace rdmapp
       }
    }
 
-   void queue_pair::rtr(uint16_t remote_lid, uint32_t remote_qpn, uint32_t remote_psn)
+   void queue_pair::rtr(const deserialized_qp::qp_header& remote)
    {
+      rtr(remote.lid, remote.qp_num, remote.sq_psn, remote.gid);
+   }
+
+   void queue_pair::rtr(uint16_t remote_lid, uint32_t remote_qpn, uint32_t remote_psn, const ibv_gid& remote_gid)
+   {
+      auto const& device = *pd_->device;
       struct ibv_qp_attr qp_attr = {};
       ::bzero(&qp_attr, sizeof(qp_attr));
       qp_attr.qp_state = IBV_QPS_RTR;
-      qp_attr.path_mtu = IBV_MTU_4096;
+      // RoCE ports usually run below 4096 bytes, following the Ethernet MTU.
+      qp_attr.path_mtu = std::min(IBV_MTU_4096, device.port_attr.active_mtu);
       qp_attr.dest_qp_num = remote_qpn;
       qp_attr.rq_psn = remote_psn;
       qp_attr.max_dest_rd_atomic = 1;
@@ -127,7 +169,20 @@ namespace rdmapp
       qp_attr.ah_attr.dlid = remote_lid;
       qp_attr.ah_attr.sl = 0;
       qp_attr.ah_attr.src_path_bits = 0;
-      qp_attr.ah_attr.port_num = pd_->device->port_num;
+      qp_attr.ah_attr.port_num = device.port_num;
+      if (device.is_roce() || remote_lid == 0) {
+         // Without LIDs, packets are routed by the global route header.
+         if (device.gid_index < 0) {
+            destroy();
+            throw_with("qp needs a gid to reach lid %u, but port %u has none", remote_lid, device.port_num);
+         }
+         qp_attr.ah_attr.is_global = 1;
+         qp_attr.ah_attr.grh.dgid = remote_gid;
+         qp_attr.ah_attr.grh.sgid_index = device.gid_index;
+         qp_attr.ah_attr.grh.hop_limit = device.hop_limit;
+         qp_attr.ah_attr.grh.traffic_class = device.traffic_class;
+         qp_attr.ah_attr.grh.flow_label = 0;
+      }
 
       try {
          check_rc(::ibv_modify_qp(qp_, &qp_attr,
@@ -139,6 +194,7 @@ namespace rdmapp
          destroy();
          throw;
       }
+      remote_ = deserialized_qp::qp_header{remote_lid, remote_qpn, remote_psn, 0, remote_gid};
    }
 
    void queue_pair::rts()
@@ -164,6 +220,80 @@ namespace rdmapp
       }
    }
 
+   void queue_pair::reinit()
+   {
+      if (qp_ == nullptr) [[unlikely]] {
+         throw_with("cannot reset a destroyed qp");
+      }
+      struct ibv_qp_attr qp_attr = {};
+      qp_attr.qp_state = IBV_QPS_RESET;
+      try {
+         check_rc(::ibv_modify_qp(qp_, &qp_attr, IBV_QP_STATE), "failed to transition qp to reset state");
+      }
+      catch (const std::exception& e) {
+         destroy();
+         throw;
+      }
+      sq_psn_ = next_sq_psn.fetch_add(1);
+      init();
+   }
+
+   void queue_pair::reset()
+   {
+      reinit();
+      user_data_.clear();
+      remote_.reset();
+   }
+
+   queue_pair::drain_awaitable queue_pair::drain() { return drain_awaitable(this->shared_from_this()); }
+
+   uint32_t queue_pair::prepare_recovery()
+   {
+      if (!remote_) [[unlikely]] {
+         throw_with("cannot recover a qp that was never connected");
+      }
+      reinit();
+      RDMAPP_LOG_DEBUG("qp %u prepared for recovery with psn=%u", qp_->qp_num, sq_psn_);
+      return sq_psn_;
+   }
+
+   void queue_pair::recover(uint32_t remote_psn)
+   {
+      if (!remote_) [[unlikely]] {
+         throw_with("cannot recover a qp that was never connected");
+      }
+      auto remote = *remote_;
+      rtr(remote.lid, remote.qp_num, remote_psn, remote.gid);
+      rts();
+      RDMAPP_LOG_DEBUG("qp %u recovered to remote qpn=%u psn=%u", qp_->qp_num, remote.qp_num, remote_psn);
+   }
+
+   void queue_pair::modify(ibv_qp_attr& attr, int attr_mask)
+   {
+      try {
+         check_rc(::ibv_modify_qp(qp_, &attr, attr_mask), "failed to transition qp");
+      }
+      catch (const std::exception& e) {
+         destroy();
+         throw;
+      }
+   }
+
+   uint32_t queue_pair::qp_num() const { return qp_->qp_num; }
+
+   void queue_pair::set_error()
+   {
+      // Destroyed after a failed transition, so nothing is outstanding to flush.
+      if (qp_ == nullptr) [[unlikely]] {
+         return;
+      }
+      struct ibv_qp_attr qp_attr = {};
+      qp_attr.qp_state = IBV_QPS_ERR;
+      if (auto rc = ::ibv_modify_qp(qp_, &qp_attr, IBV_QP_STATE); rc != 0) [[unlikely]] {
+         RDMAPP_LOG_ERROR("failed to transition qp %p to error state: %s", reinterpret_cast<void*>(qp_), strerror(rc));
+      }
+   }
+
    void queue_pair::post_send(const ibv_send_wr& send_wr, ibv_send_wr*& bad_send_wr)
    {
       RDMAPP_LOG_TRACE("post send wr_id=%p addr=%p", reinterpret_cast<void*>(send_wr.wr_id),
@@ -193,7 +323,6 @@ namespace rdmapp
       : qp_(qp),
         local_mr_(std::make_shared<local_mr>(qp_->pd_->reg_mr(buffer, length))),
         remote_mr_(),
-        wc_(),
         opcode_(opcode)
    {}
    queue_pair::send_awaitable::send_awaitable(std::shared_ptr<queue_pair> qp, void* buffer, size_t length, enum ibv_wr_opcode opcode,
@@ -230,7 +359,7 @@ namespace rdmapp
    {}
    queue_pair::send_awaitable::send_awaitable(std::shared_ptr<queue_pair> qp, std::shared_ptr<local_mr> local_mr,
                                       enum ibv_wr_opcode opcode)
-      : qp_(qp), local_mr_(local_mr), remote_mr_(), wc_(), opcode_(opcode)
+      : qp_(qp), local_mr_(local_mr), remote_mr_(), opcode_(opcode)
    {}
    queue_pair::send_awaitable::send_awaitable(std::shared_ptr<queue_pair> qp, std::shared_ptr<local_mr> local_mr,
                                       enum ibv_wr_opcode opcode, const remote_mr& remote_mr)
@@ -251,6 +380,15 @@ namespace rdmapp
       : qp_(qp), local_mr_(local_mr), remote_mr_(remote_mr), compare_add_(compare), swap_(swap), opcode_(opcode)
    {}
 
+   queue_pair::send_awaitable::send_awaitable(std::shared_ptr<queue_pair> qp, std::shared_ptr<local_mr> local_mr,
+                                              size_t offset, uint32_t length, enum ibv_wr_opcode opcode,
+                                              const remote_mr& remote_mr)
+      : qp_(qp), local_mr_(local_mr), remote_mr_(remote_mr), opcode_(opcode), local_offset_(offset),
+        local_length_(length)
+   {
+      assert(offset + length <= local_mr_->length());
+   }
+
    static inline struct ibv_sge fill_local_sge(const local_mr& mr)
    {
       struct ibv_sge sge = {};
@@ -263,19 +401,20 @@ namespace rdmapp
    bool queue_pair::send_awaitable::await_ready() const noexcept { return false; }
    bool queue_pair::send_awaitable::await_suspend(std::coroutine_handle<> h) noexcept
    {
-      auto callback = executor::make_callback([h, this](const ibv_wc& wc) {
-         wc_ = wc;
-         h.resume();
-      });
+      h_ = h;
 
       auto send_sge = fill_local_sge(*local_mr_);
+      if (local_length_) {
+         send_sge.addr += local_offset_;
+         send_sge.length = *local_length_;
+      }
 
       struct ibv_send_wr send_wr = {};
       struct ibv_send_wr* bad_send_wr = nullptr;
       send_wr.opcode = opcode_;
       send_wr.next = nullptr;
       send_wr.num_sge = 1;
-      send_wr.wr_id = reinterpret_cast<uint64_t>(callback);
+      send_wr.wr_id = wr_id();
       send_wr.send_flags = IBV_SEND_SIGNALED;
       send_wr.sg_list = &send_sge;
       if (is_rdma()) {
@@ -301,7 +440,6 @@ namespace rdmapp
       }
       catch (std::runtime_error& e) {
          exception_ = std::make_exception_ptr(e);
-         executor::destroy_callback(callback);
          return false;
       }
       return true;
@@ -380,6 +518,20 @@ namespace rdmapp
       return queue_pair::send_awaitable(this->shared_from_this(), local_mr, IBV_WR_RDMA_READ, remote_mr);
    }
 
+   queue_pair::send_awaitable queue_pair::write(const remote_mr& remote_mr, std::shared_ptr<local_mr> local_mr,
+                                                size_t offset, uint32_t length)
+   {
+      return queue_pair::send_awaitable(this->shared_from_this(), local_mr, offset, length, IBV_WR_RDMA_WRITE,
+                                        remote_mr);
+   }
+
+   queue_pair::send_awaitable queue_pair::read(const remote_mr& remote_mr, std::shared_ptr<local_mr> local_mr,
+                                               size_t offset, uint32_t length)
+   {
+      return queue_pair::send_awaitable(this->shared_from_this(), local_mr, offset, length, IBV_WR_RDMA_READ,
+                                        remote_mr);
+   }
+
    queue_pair::send_awaitable queue_pair::fetch_and_add(const remote_mr& remote_mr, std::shared_ptr<local_mr> local_mr, uint64_t add)
    {
       assert(pd_->device->is_fetch_and_add_supported());
@@ -395,19 +547,16 @@ namespace rdmapp
    }
 
    queue_pair::recv_awaitable::recv_awaitable(std::shared_ptr<queue_pair> qp, void* buffer, size_t length)
-      : qp_(qp), local_mr_(std::make_shared<local_mr>(qp_->pd_->reg_mr(buffer, length))), wc_()
+      : qp_(qp), local_mr_(std::make_shared<local_mr>(qp_->pd_->reg_mr(buffer, length)))
    {}
    queue_pair::recv_awaitable::recv_awaitable(std::shared_ptr<queue_pair> qp, std::shared_ptr<local_mr> local_mr)
-      : qp_(qp), local_mr_(local_mr), wc_()
+      : qp_(qp), local_mr_(local_mr)
    {}
 
    bool queue_pair::recv_awaitable::await_ready() const noexcept { return false; }
    bool queue_pair::recv_awaitable::await_suspend(std::coroutine_handle<> h) noexcept
    {
-      auto callback = executor::make_callback([h, this](const ibv_wc& wc) {
-         wc_ = wc;
-         h.resume();
-      });
+      h_ = h;
 
       auto recv_sge = fill_local_sge(*local_mr_);
 
@@ -415,7 +564,7 @@ namespace rdmapp
       ibv_recv_wr* bad_recv_wr{};
       recv_wr.next = nullptr;
       recv_wr.num_sge = 1;
-      recv_wr.wr_id = reinterpret_cast<uint64_t>(callback);
+      recv_wr.wr_id = wr_id();
       recv_wr.sg_list = &recv_sge;
 
       try {
@@ -423,7 +572,6 @@ namespace rdmapp
       }
       catch (std::runtime_error& e) {
          exception_ = std::make_exception_ptr(e);
-         executor::destroy_callback(callback);
          return false;
       }
       return true;
@@ -441,6 +589,68 @@ namespace rdmapp
       return std::make_pair(wc_.byte_len, std::nullopt);
    }
 
+   queue_pair::drain_awaitable::drain_awaitable(std::shared_ptr<queue_pair> qp) : qp_(qp)
+   {
+      send_marker_.complete = &drain_awaitable::on_flushed;
+      send_marker_.self_ = this;
+      recv_marker_.complete = &drain_awaitable::on_flushed;
+      recv_marker_.self_ = this;
+   }
+
+   void queue_pair::drain_awaitable::on_flushed(completion_record* self, const ibv_wc& wc)
+   {
+      RDMAPP_LOG_TRACE("drain marker flushed status=%d", wc.status);
+      auto awaitable = static_cast<marker*>(self)->self_;
+      if (awaitable->remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+         awaitable->h_.resume();
+      }
+   }
+
+   bool queue_pair::drain_awaitable::await_ready() const noexcept { return false; }
+   bool queue_pair::drain_awaitable::await_suspend(std::coroutine_handle<> h) noexcept
+   {
+      h_ = h;
+      struct ibv_qp_attr qp_attr = {};
+      qp_attr.qp_state = IBV_QPS_ERR;
+      if (auto rc = ::ibv_modify_qp(qp_->qp_, &qp_attr, IBV_QP_STATE); rc != 0) [[unlikely]] {
+         exception_ = std::make_exception_ptr(std::runtime_error("failed to transition qp to error state"));
+         return false;
+      }
+
+      // One for each marker, and one held until both are posted.
+      bool drain_rq = qp_->srq_ == nullptr;
+      remaining_.store(drain_rq ? 3 : 2, std::memory_order_relaxed);
+
+      // The markers are never executed, so they carry no data.
+      struct ibv_send_wr send_wr = {};
+      struct ibv_send_wr* bad_send_wr = nullptr;
+      send_wr.opcode = IBV_WR_RDMA_WRITE;
+      send_wr.wr_id = send_marker_.wr_id();
+      send_wr.send_flags = IBV_SEND_SIGNALED;
+      if (::ibv_post_send(qp_->qp_, &send_wr, &bad_send_wr) != 0) [[unlikely]] {
+         exception_ = std::make_exception_ptr(std::runtime_error("failed to post send drain marker"));
+         remaining_.fetch_sub(1, std::memory_order_relaxed);
+      }
+
+      if (drain_rq) {
+         struct ibv_recv_wr recv_wr = {};
+         struct ibv_recv_wr* bad_recv_wr = nullptr;
+         recv_wr.wr_id = recv_marker_.wr_id();
+         if (::ibv_post_recv(qp_->qp_, &recv_wr, &bad_recv_wr) != 0) [[unlikely]] {
+            exception_ = std::make_exception_ptr(std::runtime_error("failed to post recv drain marker"));
+            remaining_.fetch_sub(1, std::memory_order_relaxed);
+         }
+      }
+      return remaining_.fetch_sub(1, std::memory_order_acq_rel) != 1;
+   }
+
+   void queue_pair::drain_awaitable::await_resume() const
+   {
+      if (exception_) [[unlikely]] {
+         std::rethrow_exception(exception_);
+      }
+   }
+
    queue_pair::recv_awaitable queue_pair::recv(void* buffer, size_t length)
    {
       return queue_pair::recv_awaitable(this->shared_from_this(), buffer, length);
@@ -463,6 +673,16 @@ namespace rdmapp
       else {
          RDMAPP_LOG_TRACE("destroyed qp %p", reinterpret_cast<void*>(qp_));
       }
+      qp_ = nullptr;
+      detach_cqs();
+   }
+
+   void queue_pair::detach_cqs()
+   {
+      send_cq_->detach(max_send_wr_ + kDrainWrs);
+      if (srq_ == nullptr) {
+         recv_cq_->detach(max_recv_wr_ + kDrainWrs);
+      }
    }
 
    queue_pair::~queue_pair() { destroy(); }
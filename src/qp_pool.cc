@@ -0,0 +1,147 @@
+#include "rdmapp/qp_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "rdmapp/detail/debug.h"
+
+namespace rdmapp
+{
+   qp_pool::qp_pool(std::shared_ptr<protected_domain> pd, std::shared_ptr<completion_queue> recv_cq,
+                    std::shared_ptr<completion_queue> send_cq, std::shared_ptr<shared_receive_queue> srq,
+                    qp_pool_config config)
+      : pd_(pd), recv_cq_(recv_cq), send_cq_(send_cq), srq_(srq), config_(config), worker_(&qp_pool::worker, this)
+   {}
+
+   qp_pool::qp_pool(std::shared_ptr<protected_domain> pd, std::shared_ptr<completion_queue> cq,
+                    std::shared_ptr<shared_receive_queue> srq, qp_pool_config config)
+      : qp_pool(pd, cq, cq, srq, config)
+   {}
+
+   std::unique_ptr<queue_pair> qp_pool::create()
+   {
+      return std::unique_ptr<queue_pair>(new queue_pair(pd_, recv_cq_, send_cq_, srq_));
+   }
+
+   std::shared_ptr<queue_pair> qp_pool::acquire()
+   {
+      std::unique_ptr<queue_pair> qp;
+      {
+         std::lock_guard lock(mutex_);
+         if (!idle_.empty()) {
+            qp = std::move(idle_.back());
+            idle_.pop_back();
+            ++stats_.hits;
+         }
+         else {
+            ++stats_.misses;
+         }
+      }
+      cv_.notify_one();
+      if (qp == nullptr) {
+         qp = create();
+      }
+      return std::shared_ptr<queue_pair>(qp.release(), [pool = weak_from_this()](queue_pair* qp) {
+         if (auto self = pool.lock()) {
+            self->release(qp);
+         }
+         else {
+            delete qp;
+         }
+      });
+   }
+
+   void qp_pool::release(queue_pair* qp)
+   {
+      std::unique_ptr<queue_pair> owned(qp);
+      {
+         std::lock_guard lock(mutex_);
+         if (stopped_) {
+            return;
+         }
+         released_.push_back(std::move(owned));
+      }
+      cv_.notify_one();
+   }
+
+   void qp_pool::worker()
+   {
+      auto retry_delay = kMinRetryDelay;
+      std::unique_lock lock(mutex_);
+      while (true) {
+         cv_.wait(lock, [this]() { return stopped_ || !released_.empty() || idle_.size() < config_.min_idle; });
+         if (stopped_) {
+            return;
+         }
+         // Verbs calls are made without the lock, so acquire() is never held up by them.
+         if (!released_.empty()) {
+            auto qp = std::move(released_.back());
+            released_.pop_back();
+            if (idle_.size() >= config_.max_idle) {
+               lock.unlock();
+               qp.reset();
+               lock.lock();
+               continue;
+            }
+            lock.unlock();
+            try {
+               qp->reset();
+            }
+            catch (const std::exception& e) {
+               RDMAPP_LOG_ERROR("dropping qp that failed to reset: %s", e.what());
+               qp.reset();
+            }
+            lock.lock();
+            if (qp != nullptr) {
+               idle_.push_back(std::move(qp));
+               ++stats_.recycled;
+            }
+            continue;
+         }
+         lock.unlock();
+         std::unique_ptr<queue_pair> qp;
+         try {
+            qp = create();
+         }
+         catch (const std::exception& e) {
+            RDMAPP_LOG_ERROR("failed to fill qp pool, retrying in %lld ms: %s",
+                             static_cast<long long>(retry_delay.count()), e.what());
+            lock.lock();
+            // The error may be transient, such as a full CQ, so retry with a growing delay, or once a Queue Pair is
+            // released.
+            cv_.wait_for(lock, retry_delay, [this]() { return stopped_ || !released_.empty(); });
+            retry_delay = std::min(retry_delay * 2, kMaxRetryDelay);
+            continue;
+         }
+         retry_delay = kMinRetryDelay;
+         lock.lock();
+         idle_.push_back(std::move(qp));
+      }
+   }
+
+   size_t qp_pool::idle()
+   {
+      std::lock_guard lock(mutex_);
+      return idle_.size();
+   }
+
+   qp_pool_stats qp_pool::stats()
+   {
+      std::lock_guard lock(mutex_);
+      return stats_;
+   }
+
+   qp_pool::~qp_pool()
+   {
+      {
+         std::lock_guard lock(mutex_);
+         stopped_ = true;
+      }
+      cv_.notify_all();
+      worker_.join();
+   }
+} // namespace rdmapp